@@ -23,35 +23,71 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 #include "bitstream.h"
+#include "sink.h"
 #include "base.h"
+#include "chain.h"
+#include "pack.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "asyncio.h"
 
-extern void encode_lzw(FILE *in, Bitstream *out);
-extern void decode_lzw(Bitstream *in, FILE *out);
+extern void encode_lzw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_lzw(Bitstream *in, Sink *out);
+extern Count size_lzw(FILE *in, Params const *params, int *exact);
 
-extern void encode_zle(FILE *in, Bitstream *out);
-extern void decode_zle(Bitstream *in, FILE *out);
+extern void encode_zle(FILE *in, Bitstream *out, Params const *params);
+extern void decode_zle(Bitstream *in, Sink *out);
+extern Count size_zle(FILE *in, Params const *params, int *exact);
 
-extern void encode_huff(FILE *in, Bitstream *out, Bitstream *table);
+extern void encode_huff(FILE *in, Bitstream *out, Params const *params);
+extern void decode_huff(Bitstream *in, Sink *out);
+extern Count size_huff(FILE *in, Params const *params, int *exact);
 
-static void encode_dummy(FILE *in, Bitstream *out)
+extern void encode_raw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_raw(Bitstream *in, Sink *out);
+extern Count size_raw(FILE *in, Params const *params, int *exact);
+
+extern void encode_auto(FILE *in, Bitstream *out, Params const *params);
+extern void decode_auto(Bitstream *in, Sink *out);
+extern Count size_auto(FILE *in, Params const *params, int *exact);
+
+extern void encode_delta(FILE *in, Bitstream *out, Params const *params);
+extern void decode_delta(Bitstream *in, Sink *out);
+
+extern void encode_rle(FILE *in, Bitstream *out, Params const *params);
+extern void decode_rle(Bitstream *in, Sink *out);
+
+extern void encode_dedup(FILE *in, Bitstream *out, Params const *params);
+extern void decode_dedup(Bitstream *in, Sink *out);
+
+static void encode_dummy(FILE *in, Bitstream *out, Params const *params)
 {
 	(void) in;
+	(void) params;
 	fputs("NYI", out->file);
 }
 
-static void decode_dummy(Bitstream *in, FILE *out)
+static void decode_dummy(Bitstream *in, Sink *out)
 {
 	(void) in;
-	fputs("NYI", out);
+	sinkWrite(out, "NYI", 3);
 }
 
 static Algorithm const algorithmRegistry[] = {
-	{"lzw", encode_lzw, decode_lzw},
-	{"huff", encode_dummy, decode_dummy}, // TODO huffman coding
-	{"zle", encode_zle, decode_zle},
+	{"lzw", encode_lzw, decode_lzw, ALGORITHM_STREAMS, size_lzw},
+	{"huff", encode_huff, decode_huff, 0, size_huff},
+	{"zle", encode_zle, decode_zle, ALGORITHM_STREAMS | ALGORITHM_SPARSE, size_zle},
+	{"raw", encode_raw, decode_raw, ALGORITHM_STREAMS, size_raw},
+	{"auto", encode_auto, decode_auto, 0, size_auto},
+	{"delta", encode_delta, decode_delta, ALGORITHM_STREAMS, NULL},
+	{"rle", encode_rle, decode_rle, ALGORITHM_STREAMS, NULL},
+	{"dedup", encode_dedup, decode_dedup, ALGORITHM_STREAMS, NULL},
 };
 
 static void usage(char const *name, char const *arg)
@@ -60,65 +96,272 @@ static void usage(char const *name, char const *arg)
 	fprintf(stderr, "%s: <usage goes here at some point>\n", name);
 }
 
+/* Parses "name[:arg]+name[:arg]+...". Modifies spec in place. */
+static int parseChain(char *spec, Chain *chain)
+{
+	chain->count = 0;
+	for (char *stage = strtok(spec, "+"); stage != NULL; stage = strtok(NULL, "+")) {
+		if (chain->count >= CHAIN_MAX_STAGES) return -1;
+		char *arg = strchr(stage, ':');
+		if (arg != NULL) *arg++ = '\0';
+		Algorithm const *algorithm = NULL;
+		for (int i = 0; i < (int)STATIC_LENGTH(algorithmRegistry); ++i) {
+			if (strcmp(algorithmRegistry[i].identifier, stage) == 0) {
+				algorithm = &algorithmRegistry[i];
+				break;
+			}
+		}
+		if (algorithm == NULL) return -1;
+		chain->stages[chain->count] = algorithm;
+		chain->params[chain->count] = (Params) {arg, 0, 0};
+		++chain->count;
+	}
+	return chain->count > 0 ? 0 : -1;
+}
+
+/* Parses a byte count with an optional K, M or G suffix. */
+static int parseSize(char const *str, Count *size)
+{
+	char *end;
+	long long value = strtoll(str, &end, 0);
+	if (end == str || value < 0) return -1;
+	switch (*end) {
+	case 'k': case 'K': value = KB(value); ++end; break;
+	case 'm': case 'M': value = MB(value); ++end; break;
+	case 'g': case 'G': value = GB(value); ++end; break;
+	}
+	if (*end != '\0') return -1;
+	*size = value;
+	return 0;
+}
+
+static FILE *seekableInput(FILE *in)
+{
+	if (fseek(in, 0, SEEK_CUR) == 0) return in;
+	FILE *spool = tmpfile();
+	char buf[KB(64)];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), in)) > 0)
+		fwrite(buf, 1, len, spool);
+	rewind(spool);
+	return spool;
+}
+
+/* Whether encoding or sizing has to go over the input more than once. */
+static int chainSeeks(Chain const *chain)
+{
+	if (chain->count > 1) return 1;
+	return !(chain->stages[0]->flags & ALGORITHM_STREAMS);
+}
+
 int main(int argc, char *argv[])
 {
 	(void) encode_dummy;
 	(void) decode_dummy;
 
-	if (argc != 3) {
+	unsigned pack_flags = 0;
+	Count mem_budget = 0;
+	int level = 0;
+	int verbose = 0;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+		if (strcmp(argv[argi], "-c") == 0 || strcmp(argv[argi], "--checksum") == 0) {
+			pack_flags |= PACK_CHECKSUM;
+		} else if ((strcmp(argv[argi], "-m") == 0 || strcmp(argv[argi], "--mem") == 0) && argi + 1 < argc) {
+			if (parseSize(argv[++argi], &mem_budget) != 0) {
+				usage(argv[0], "memory budget");
+				return EXIT_FAILURE;
+			}
+		} else if (argv[argi][1] >= '0' + LEVEL_MIN && argv[argi][1] <= '0' + LEVEL_MAX && argv[argi][2] == '\0') {
+			level = argv[argi][1] - '0';
+		} else if (strcmp(argv[argi], "--level") == 0 && argi + 1 < argc) {
+			level = atoi(argv[++argi]);
+			if (level < LEVEL_MIN || level > LEVEL_MAX) {
+				usage(argv[0], "level");
+				return EXIT_FAILURE;
+			}
+		} else if (strcmp(argv[argi], "-v") == 0 || strcmp(argv[argi], "--verbose") == 0) {
+			verbose = 1;
+		} else if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+			threads = atoi(argv[++argi]);
+			if (threads < 1) {
+				usage(argv[0], "thread count");
+				return EXIT_FAILURE;
+			}
+		} else {
+			usage(argv[0], "option");
+			return EXIT_FAILURE;
+		}
+	}
+	char **args = argv + argi;
+	int nargs = argc - argi;
+
+	if (nargs < 2) {
 		usage(argv[0], "argument count");
 		return EXIT_FAILURE;
 	}
 
-	Algorithm const *algorithm = NULL;
-	for (int i = 0; i < (int)STATIC_LENGTH(algorithmRegistry); ++i) {
-		if (strcmp(algorithmRegistry[i].identifier, argv[1]) == 0) {
-			algorithm = &algorithmRegistry[i];
-			break;
-		}
-	}
-	if (algorithm == NULL) {
+	Chain chain;
+	if (parseChain(args[0], &chain) != 0) {
 		usage(argv[0], "algorithm");
 		return EXIT_FAILURE;
 	}
 
-	enum { ENCODE, DECODE, ROUNDTRIP } mode;
-	if (strcmp(argv[2], "encode") == 0) {
+	enum { ENCODE, DECODE, ROUNDTRIP, SIZE, PACK, UNPACK, EXTRACT, BATCH } mode;
+	int mode_nargs = 0;
+	if (strcmp(args[1], "encode") == 0) {
 		mode = ENCODE;
-	} else if (strcmp(argv[2], "decode") == 0) {
+	} else if (strcmp(args[1], "decode") == 0) {
 		mode = DECODE;
-	} else if (strcmp(argv[2], "roundtrip") == 0) {
+	} else if (strcmp(args[1], "roundtrip") == 0) {
 		mode = ROUNDTRIP;
+	} else if (strcmp(args[1], "size") == 0) {
+		mode = SIZE;
+	} else if (strcmp(args[1], "pack") == 0) {
+		mode = PACK;
+	} else if (strcmp(args[1], "unpack") == 0) {
+		mode = UNPACK;
+	} else if (strcmp(args[1], "extract") == 0) {
+		mode = EXTRACT;
+		mode_nargs = 2;
+	} else if (strcmp(args[1], "batch") == 0) {
+		mode = BATCH;
+		mode_nargs = nargs > 2 ? nargs - 2 : 1; // one or more paths
 	} else {
 		usage(argv[0], "mode");
 		return EXIT_FAILURE;
 	}
+	if (nargs != 2 + mode_nargs) {
+		usage(argv[0], "argument count");
+		return EXIT_FAILURE;
+	}
+	// only packed streams have room for checksums; unpacking checks them whenever present.
+	if ((pack_flags & PACK_CHECKSUM) && mode != PACK && mode != BATCH) {
+		usage(argv[0], "option for this mode");
+		return EXIT_FAILURE;
+	}
+
+	Count offset = 0, length = 0;
+	if (mode == EXTRACT) {
+		char *end1, *end2;
+		offset = strtoll(args[2], &end1, 0);
+		length = strtoll(args[3], &end2, 0);
+		if (*end1 != '\0' || *end2 != '\0' || offset < 0 || length < 0) {
+			usage(argv[0], "offset or length");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// packing keeps a few blocks around, and batch mode does so once per thread.
+	// A pipelined chain runs all its stages at once, next to the rings between
+	// them; if the rings alone would take half the budget, the stages take turns.
+	// Sizing has to budget just like the encoder it stands in for.
+	uint32_t block_size = packBlockSize(level, mem_budget);
+	Count codec_budget = mem_budget;
+	int pipelined = 1;
+	if (mode == PACK) {
+		codec_budget = mem_budget / 2;
+	} else if (mode == BATCH) {
+		block_size = packBlockSize(level, mem_budget / threads);
+		codec_budget = mem_budget / threads / 2;
+	} else if (mem_budget > 0 && (mode == ENCODE || mode == DECODE || mode == ROUNDTRIP || mode == SIZE)) {
+		Count const rings = pipelineMemory(&chain);
+		if (rings <= mem_budget / 2) {
+			codec_budget = (mem_budget - rings) / chain.count;
+		} else {
+			pipelined = 0;
+		}
+	}
+	for (int i = 0; i < chain.count; ++i) {
+		chain.params[i].mem_budget = codec_budget;
+		chain.params[i].level = level;
+	}
+
+	// overlap reading and writing with the actual work, except where we seek around.
+	FILE *in = NULL, *out = NULL;
+	switch (mode) {
+	case ENCODE: case ROUNDTRIP: case SIZE:
+		// a pipe is only spooled if the chain needs to seek, and a prefetching
+		// stream would hide the holes in the file from the first stage.
+		in = chainSeeks(&chain) ? seekableInput(stdin) : stdin;
+		if (!(chain.stages[0]->flags & ALGORITHM_SPARSE)) in = openPrefetchReader(in);
+		break;
+	case UNPACK:
+		in = openPrefetchReader(seekableInput(stdin));
+		break;
+	case DECODE: case PACK:
+		in = openPrefetchReader(stdin);
+		break;
+	default:
+		break;
+	}
+	// decoded output goes straight to the file descriptor, spliced if it is a pipe.
+	Sink *sink = NULL;
+	switch (mode) {
+	case ENCODE: case PACK:
+		out = openWriteBehind(stdout);
+		break;
+	case DECODE: case ROUNDTRIP: case UNPACK: case EXTRACT:
+		sink = sinkOpenFd(STDOUT_FILENO);
+		break;
+	default:
+		break;
+	}
 
 	FILE *buf;
+	int status = 0, exact;
+	Count bits;
 	Bitstream outb, inb;
 	switch (mode) {
 	case ENCODE:
-		outb = (Bitstream) {stdout, 0, 0};
-		algorithm->encode(stdin, &outb);
+		outb = (Bitstream) {out, 0, 0};
+		(pipelined ? encodeChainPipelined : encodeChain)(&chain, in, &outb);
 		bitstreamFlushWrite(&outb);
 		break;
 	case DECODE:
-		inb = (Bitstream) {stdin, 0, 0};
+		inb = (Bitstream) {in, 0, 0};
 		bitstreamFlushRead(&inb);
-		algorithm->decode(&inb, stdout);
+		(pipelined ? decodeChainPipelined : decodeChain)(&chain, &inb, sink);
 		break;
 	case ROUNDTRIP:
 		buf = tmpfile();
 		outb = (Bitstream) {buf, 0, 0};
-		algorithm->encode(stdin, &outb);
+		(pipelined ? encodeChainPipelined : encodeChain)(&chain, in, &outb);
 		bitstreamFlushWrite(&outb);
 		rewind(buf);
 		inb = (Bitstream) {buf, 0, 0};
 		bitstreamFlushRead(&inb);
-		algorithm->decode(&inb, stdout);
+		(pipelined ? decodeChainPipelined : decodeChain)(&chain, &inb, sink);
 		fclose(buf);
 		break;
+	case SIZE:
+		// what encode would write; its final flush puts down a word even when empty.
+		bits = sizeChain(&chain, in, &exact);
+		printf("%lld%s\n", (long long) (bits > 0 ? (bits + 31) / 32 * 4 : 4), exact ? "" : " (estimate)");
+		break;
+	case PACK:
+		status = packStream(&chain, in, out, block_size, pack_flags);
+		break;
+	case UNPACK:
+		status = unpackStream(&chain, in, sink);
+		break;
+	case EXTRACT:
+		status = extractRange(&chain, seekableInput(stdin), sink, offset, length);
+		break;
+	case BATCH:
+		status = batchPack(&chain, args + 2, nargs - 2, block_size, pack_flags, threads);
+		break;
 	}
 
-	return EXIT_SUCCESS;
+	if (in != NULL) fclose(in);
+	if (out != NULL && fclose(out) != 0) status = -1;
+	if (sink != NULL && sinkClose(sink) != 0) status = -1;
+
+	if (verbose) {
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		fprintf(stderr, "peak memory: %ld KiB\n", usage.ru_maxrss);
+	}
+	return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,272 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for fopencookie
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "asyncio.h"
+
+typedef struct {
+	FILE *src;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned char *bufs[2];
+	size_t lens[2];
+	int full[2];
+	int fill;     // next buffer the thread reads into
+	int cur;      // buffer the consumer reads from
+	size_t pos;   // consumer position within bufs[cur]
+	int finished; // the thread is out of input and gone
+	int stop;
+	int seekable; // whether src can go back at all
+	off64_t offset; // logical stream position
+} Prefetcher;
+
+typedef struct {
+	FILE *dst;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned char *bufs[2];
+	size_t lens[2];
+	int full[2];
+	int cur;   // buffer the producer writes into
+	int drain; // next buffer the thread writes out
+	int stop;
+	int error;
+} WriteBehind;
+
+static void *prefetchMain(void *ud)
+{
+	Prefetcher *p = ud;
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!p->stop && p->full[p->fill])
+			pthread_cond_wait(&p->cond, &p->lock);
+		if (p->stop) break;
+		int const b = p->fill;
+		pthread_mutex_unlock(&p->lock);
+		size_t len = fread(p->bufs[b], 1, ASYNC_BUFFER_SIZE, p->src);
+		pthread_mutex_lock(&p->lock);
+		p->lens[b] = len;
+		p->full[b] = 1;
+		p->fill ^= 1;
+		pthread_cond_broadcast(&p->cond);
+		if (len < ASYNC_BUFFER_SIZE) break; // fread only comes up short at EOF or on errors
+	}
+	p->finished = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static void startPrefetch(Prefetcher *p)
+{
+	p->full[0] = p->full[1] = 0;
+	p->fill = p->cur = 0;
+	p->pos = 0;
+	p->finished = 0;
+	p->stop = 0;
+	pthread_create(&p->thread, NULL, prefetchMain, p);
+}
+
+static void stopPrefetch(Prefetcher *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	pthread_join(p->thread, NULL);
+}
+
+static ssize_t prefetchRead(void *cookie, char *buf, size_t size)
+{
+	Prefetcher *p = cookie;
+	size_t done = 0;
+	while (done < size) {
+		pthread_mutex_lock(&p->lock);
+		while (!p->full[p->cur] && !p->finished)
+			pthread_cond_wait(&p->cond, &p->lock);
+		int const avail = p->full[p->cur];
+		pthread_mutex_unlock(&p->lock);
+		if (!avail) break;
+
+		size_t n = p->lens[p->cur] - p->pos;
+		if (n > size - done) n = size - done;
+		memcpy(buf + done, p->bufs[p->cur] + p->pos, n);
+		p->pos += n;
+		done += n;
+		if (p->pos == p->lens[p->cur]) {
+			pthread_mutex_lock(&p->lock);
+			p->full[p->cur] = 0;
+			p->cur ^= 1;
+			p->pos = 0;
+			pthread_cond_broadcast(&p->cond);
+			pthread_mutex_unlock(&p->lock);
+		}
+	}
+	p->offset += done;
+	return done;
+}
+
+static int prefetchSeek(void *cookie, off64_t *offset, int whence)
+{
+	Prefetcher *p = cookie;
+	if (whence == SEEK_CUR && *offset == 0) {
+		*offset = p->offset;
+		return 0;
+	}
+	// restarting would throw away what was already prefetched from a pipe.
+	if (!p->seekable) {
+		errno = ESPIPE;
+		return -1;
+	}
+	stopPrefetch(p);
+	if (whence == SEEK_CUR) {
+		*offset += p->offset;
+		whence = SEEK_SET;
+	}
+	int status = fseeko(p->src, *offset, whence);
+	if (status == 0) p->offset = ftello(p->src);
+	*offset = p->offset;
+	startPrefetch(p);
+	return status;
+}
+
+static int prefetchClose(void *cookie)
+{
+	Prefetcher *p = cookie;
+	stopPrefetch(p);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->cond);
+	free(p->bufs[0]);
+	free(p->bufs[1]);
+	free(p);
+	return 0;
+}
+
+FILE *openPrefetchReader(FILE *src)
+{
+	Prefetcher *p = calloc(1, sizeof(*p));
+	p->src = src;
+	p->bufs[0] = malloc(ASYNC_BUFFER_SIZE);
+	p->bufs[1] = malloc(ASYNC_BUFFER_SIZE);
+	p->offset = ftello(src);
+	p->seekable = p->offset >= 0 && fseeko(src, 0, SEEK_CUR) == 0;
+	if (p->offset < 0) p->offset = 0;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	startPrefetch(p);
+	return fopencookie(p, "r", (cookie_io_functions_t) {prefetchRead, NULL, prefetchSeek, prefetchClose});
+}
+
+static void *writeBehindMain(void *ud)
+{
+	WriteBehind *w = ud;
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->stop && !w->full[w->drain])
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (!w->full[w->drain]) break; // stopped, and everything is written
+		int const b = w->drain;
+		pthread_mutex_unlock(&w->lock);
+		if (fwrite(w->bufs[b], 1, w->lens[b], w->dst) != w->lens[b] || fflush(w->dst) != 0)
+			w->error = 1;
+		pthread_mutex_lock(&w->lock);
+		w->lens[b] = 0;
+		w->full[b] = 0;
+		w->drain ^= 1;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/* hands the current buffer to the thread and waits for the other one to be free. */
+static void swapWriteBuffer(WriteBehind *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->full[w->cur] = 1;
+	w->cur ^= 1;
+	pthread_cond_broadcast(&w->cond);
+	while (w->full[w->cur])
+		pthread_cond_wait(&w->cond, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static ssize_t writeBehindWrite(void *cookie, char const *buf, size_t size)
+{
+	WriteBehind *w = cookie;
+	size_t done = 0;
+	while (done < size) {
+		size_t n = ASYNC_BUFFER_SIZE - w->lens[w->cur];
+		if (n > size - done) n = size - done;
+		memcpy(w->bufs[w->cur] + w->lens[w->cur], buf + done, n);
+		w->lens[w->cur] += n;
+		done += n;
+		if (w->lens[w->cur] == ASYNC_BUFFER_SIZE)
+			swapWriteBuffer(w);
+	}
+	return w->error ? -1 : (ssize_t) done;
+}
+
+static int writeBehindClose(void *cookie)
+{
+	WriteBehind *w = cookie;
+	pthread_mutex_lock(&w->lock);
+	if (w->lens[w->cur] > 0)
+		w->full[w->cur] = 1;
+	w->stop = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	int status = w->error ? EOF : 0;
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	free(w->bufs[0]);
+	free(w->bufs[1]);
+	free(w);
+	return status;
+}
+
+FILE *openWriteBehind(FILE *dst)
+{
+	WriteBehind *w = calloc(1, sizeof(*w));
+	w->dst = dst;
+	w->bufs[0] = malloc(ASYNC_BUFFER_SIZE);
+	w->bufs[1] = malloc(ASYNC_BUFFER_SIZE);
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	pthread_create(&w->thread, NULL, writeBehindMain, w);
+	return fopencookie(w, "w", (cookie_io_functions_t) {NULL, writeBehindWrite, NULL, writeBehindClose});
+}
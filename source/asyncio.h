@@ -0,0 +1,41 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+// depends on stdio.h
+
+#ifdef CMPLAB_ASYNCIO_H
+#error multiple inclusion
+#endif
+#define CMPLAB_ASYNCIO_H
+
+#define ASYNC_BUFFER_SIZE KB(256)
+
+/* Both of these wrap an existing stream in a new one that is backed by a
+ * helper thread and two buffers: the reader fills the next buffer while the
+ * caller consumes the current one, the writer drains one buffer while the
+ * caller fills the other. Closing the returned stream stops the thread and
+ * (for the writer) flushes everything, but leaves the wrapped stream open.
+ * The reader supports seeking if the wrapped stream does; it simply restarts
+ * the prefetch. */
+FILE *openPrefetchReader(FILE *src);
+FILE *openWriteBehind(FILE *dst);
@@ -0,0 +1,198 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+
+/* Picks one of the other codecs by looking at a sample of the input,
+ * and records the choice in an 8-bit header in front of that codec's stream. */
+
+extern void encode_raw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_raw(Bitstream *in, Sink *out);
+extern Count size_raw(FILE *in, Params const *params, int *exact);
+extern void encode_zle(FILE *in, Bitstream *out, Params const *params);
+extern void decode_zle(Bitstream *in, Sink *out);
+extern Count size_zle(FILE *in, Params const *params, int *exact);
+extern void encode_huff(FILE *in, Bitstream *out, Params const *params);
+extern void decode_huff(Bitstream *in, Sink *out);
+extern Count size_huff(FILE *in, Params const *params, int *exact);
+extern void encode_lzw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_lzw(Bitstream *in, Sink *out);
+extern Count size_lzw(FILE *in, Params const *params, int *exact);
+
+// ordered from cheapest to most expensive to run. never reorder, the index is stored!
+enum { AUTO_RAW, AUTO_ZLE, AUTO_HUFF, AUTO_LZW, AUTO_COUNT };
+
+static Algorithm const candidates[AUTO_COUNT] = {
+	{"raw", encode_raw, decode_raw, ALGORITHM_STREAMS, size_raw},
+	{"zle", encode_zle, decode_zle, ALGORITHM_STREAMS | ALGORITHM_SPARSE, size_zle},
+	{"huff", encode_huff, decode_huff, 0, size_huff},
+	{"lzw", encode_lzw, decode_lzw, ALGORITHM_STREAMS, size_lzw},
+};
+
+#define AUTO_CHOICE_BITS 8
+
+#define AUTO_SAMPLE_CHUNK KB(4)
+#define AUTO_SAMPLE_CHUNKS 16
+#define AUTO_SAMPLE_SIZE (AUTO_SAMPLE_CHUNK * AUTO_SAMPLE_CHUNKS)
+
+#define AUTO_HASH_BITS 12
+#define AUTO_MIN_MATCH 4
+
+#define AUTO_FAST_LEVEL 2 // up to here, only pick codecs that run at close to memory speed
+
+typedef struct {
+	double entropy;  // order-0, in bits per byte
+	Count zero_bytes; // number of zero bytes
+	Count zero_runs; // number of maximal runs of zero bytes
+	Count repeated;  // bytes covered by matches against earlier data in the same chunk
+} SampleStats;
+
+/* Reads evenly spaced chunks from the input, or all of it if it is small enough. */
+static size_t takesample(FILE *in, long start, unsigned char sample[AUTO_SAMPLE_SIZE])
+{
+	long size = -1;
+	if (fseek(in, 0, SEEK_END) == 0)
+		size = ftell(in) - start;
+	if (size >= 0 && size <= AUTO_SAMPLE_SIZE) {
+		fseek(in, start, SEEK_SET);
+		return fread(sample, 1, AUTO_SAMPLE_SIZE, in);
+	}
+	size_t len = 0;
+	for (int c = 0; c < AUTO_SAMPLE_CHUNKS; ++c) {
+		long at = start + (size - AUTO_SAMPLE_CHUNK) / (AUTO_SAMPLE_CHUNKS - 1) * c;
+		fseek(in, at, SEEK_SET);
+		len += fread(sample + len, 1, AUTO_SAMPLE_CHUNK, in);
+	}
+	return len;
+}
+
+static void countmatches(unsigned char const *data, size_t len, SampleStats *stats)
+{
+	int32_t table[1 << AUTO_HASH_BITS];
+	memset(table, -1, sizeof(table));
+	size_t i = 0;
+	while (i + AUTO_MIN_MATCH <= len) {
+		uint32_t word;
+		memcpy(&word, data + i, sizeof(word));
+		uint32_t h = (word * 2654435761u) >> (32 - AUTO_HASH_BITS);
+		int32_t cand = table[h];
+		table[h] = i;
+		if (cand >= 0 && memcmp(data + cand, data + i, AUTO_MIN_MATCH) == 0) {
+			size_t m = AUTO_MIN_MATCH;
+			while (i + m < len && data[cand + m] == data[i + m]) ++m;
+			stats->repeated += m;
+			i += m;
+		} else {
+			++i;
+		}
+	}
+}
+
+static void analyze(unsigned char const *sample, size_t len, SampleStats *stats)
+{
+	Count freqs[ALPHABET_SIZE] = {0};
+	*stats = (SampleStats) {0.0, 0, 0, 0};
+	for (size_t i = 0; i < len; ++i) {
+		++freqs[sample[i]];
+		if (sample[i] == 0 && (i == 0 || sample[i - 1] != 0))
+			++stats->zero_runs;
+	}
+	stats->zero_bytes = freqs[0];
+	for (Symbol sym = 0; sym < ALPHABET_SIZE; ++sym) {
+		if (freqs[sym] == 0) continue;
+		double p = (double) freqs[sym] / len;
+		stats->entropy -= p * log2(p);
+	}
+	for (size_t c = 0; c < len; c += AUTO_SAMPLE_CHUNK) {
+		size_t clen = len - c < AUTO_SAMPLE_CHUNK ? len - c : AUTO_SAMPLE_CHUNK;
+		countmatches(sample + c, clen, stats);
+	}
+}
+
+/* Estimated output sizes in bits for the sample. These are deliberately crude;
+ * they only have to get the order right. */
+static int choose(SampleStats const *stats, size_t len, int level)
+{
+	double cost[AUTO_COUNT];
+	cost[AUTO_RAW]  = 8.0 * len;
+	// nonzero bytes are stored as-is, each zero run costs a zero plus a gamma-coded count.
+	double avg_run = stats->zero_runs > 0 ? (double) stats->zero_bytes / stats->zero_runs : 1.0;
+	cost[AUTO_ZLE]  = 8.0 * (len - stats->zero_bytes) + (9.0 + 2.0 * floor(log2(avg_run))) * stats->zero_runs;
+	// the code length table, plus roughly the entropy for every byte, but no code is shorter than a bit.
+	cost[AUTO_HUFF] = 5.0 * ALPHABET_SIZE + 1.02 * fmax(stats->entropy, 1.0) * len;
+	// LZW needs several repetitions to learn a phrase, so matches are far from free.
+	double repeated = (double) stats->repeated / len;
+	cost[AUTO_LZW]  = len * (1.1 * stats->entropy * (1.0 - repeated) + 2.5 * repeated);
+
+	// only pay for a more expensive codec if it is noticeably better,
+	// and not at all for LZW at the fastest levels.
+	int const last = level <= AUTO_FAST_LEVEL ? AUTO_HUFF : AUTO_LZW;
+	int best = AUTO_RAW;
+	for (int c = AUTO_RAW + 1; c <= last; ++c) {
+		if (cost[c] < 0.95 * cost[best]) best = c;
+	}
+	return best;
+}
+
+/* Leaves the input where it was. */
+static int pick(FILE *in, Params const *params)
+{
+	long start = ftell(in);
+	unsigned char *sample = malloc(AUTO_SAMPLE_SIZE);
+	size_t len = takesample(in, start, sample);
+	SampleStats stats;
+	analyze(sample, len, &stats);
+	int choice = len > 0 ? choose(&stats, len, PARAMS_LEVEL(params)) : AUTO_RAW;
+	free(sample);
+	fseek(in, start, SEEK_SET);
+	return choice;
+}
+
+void encode_auto(FILE *in, Bitstream *out, Params const *params)
+{
+	int choice = pick(in, params);
+	bitstreamWriteBits(out, AUTO_CHOICE_BITS, choice);
+	candidates[choice].encode(in, out, params);
+}
+
+Count size_auto(FILE *in, Params const *params, int *exact)
+{
+	int choice = pick(in, params);
+	return AUTO_CHOICE_BITS + candidates[choice].size(in, params, exact);
+}
+
+void decode_auto(Bitstream *in, Sink *out)
+{
+	int choice = bitstreamReadBits(in, AUTO_CHOICE_BITS);
+	if (feof(in->file)) return;
+	if (choice >= AUTO_COUNT) return;
+	candidates[choice].decode(in, out);
+}
@@ -23,6 +23,7 @@
 
 // depends on stdint.h
 // depends on bitstream.h
+// depends on sink.h
 
 #ifdef CMPLAB_BASE_H
 #error multiple inclusion
@@ -41,8 +42,29 @@ typedef int64_t Count; // roughly proportional to the length of the input
 
 #define ALPHABET_SIZE 256
 
+/* compression levels trade speed for ratio; every codec maps them to its own settings. */
+#define LEVEL_MIN 1 // fastest
+#define LEVEL_MAX 9 // smallest output
+#define LEVEL_DEFAULT 5
+
+typedef struct {
+	char const *arg; // whatever followed the ':' in the algorithm name, or NULL
+	Count mem_budget; // bytes the codec may use for its tables, or 0 for its default
+	int level; // LEVEL_MIN to LEVEL_MAX, or 0 for LEVEL_DEFAULT
+} Params;
+
+#define PARAMS_LEVEL(params) ((params)->level > 0 ? (params)->level : LEVEL_DEFAULT)
+
+/* algorithm flags */
+#define ALGORITHM_STREAMS 0x1 // encode reads its input once, front to back, and never seeks
+#define ALGORITHM_SPARSE 0x2 // encode skips the holes of regular files itself, given their descriptor
+
 typedef struct {
 	char const *identifier;
-	void (*encode)(FILE *, Bitstream *);
-	void (*decode)(Bitstream *, FILE *);
+	void (*encode)(FILE *, Bitstream *, Params const *);
+	void (*decode)(Bitstream *, Sink *);
+	unsigned flags;
+	/* Optional. Returns the number of bits encode would write, without writing them,
+	 * and clears *exact if that is only an estimate. */
+	Count (*size)(FILE *, Params const *, int *exact);
 } Algorithm;
@@ -0,0 +1,401 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for pread & d_type
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+#include "pack.h"
+#include "batch.h"
+
+#define BATCH_SUFFIX ".cmp"
+
+/* Blocks finish in any order but have to land in the output in order. The
+ * block that is next in line goes straight out; one that overtook an earlier
+ * block waits in a spill file instead of in memory. */
+typedef struct {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	Count raw_size;
+	uint32_t block_count;
+	PackedBlock *blocks; // only the sizes and checksums survive for the index
+	int64_t *spilled; // offset of each waiting block in spill, -1 if it isn't there
+	int remaining; // blocks not yet packed; whoever packs the last one writes the index
+	pthread_mutex_t lock; // guards everything below
+	int in; // opened by whichever block comes first
+	FILE *out, *spill;
+	int64_t spill_size;
+	uint32_t next; // first block not written yet
+	int failed;
+} BatchFile;
+
+typedef struct {
+	BatchFile *file;
+	uint32_t block;
+} BatchTask;
+
+/* The owner pushes and pops at the bottom, thieves take from the top.
+ * Tasks never spawn new tasks, so an empty pool means we are done. */
+typedef struct {
+	pthread_mutex_t lock;
+	BatchTask *tasks;
+	size_t top, bottom, capacity;
+} TaskDeque;
+
+typedef struct {
+	Chain const *chain;
+	uint32_t block_size;
+	unsigned flags;
+	TaskDeque *deques;
+	int nworkers;
+	int failures;
+} BatchPool;
+
+typedef struct {
+	BatchPool *pool;
+	int id;
+	pthread_t thread;
+} BatchWorker;
+
+typedef struct {
+	BatchFile *files;
+	size_t count, capacity;
+	uint32_t block_size;
+} FileList;
+
+static void pushTask(TaskDeque *deque, BatchTask task)
+{
+	if (deque->bottom >= deque->capacity) {
+		deque->capacity = deque->capacity ? deque->capacity * 2 : 64;
+		deque->tasks = realloc(deque->tasks, deque->capacity * sizeof(*deque->tasks));
+	}
+	deque->tasks[deque->bottom++] = task;
+}
+
+static int popTask(TaskDeque *deque, BatchTask *task)
+{
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top) {
+		*task = deque->tasks[--deque->bottom];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static int stealTask(TaskDeque *deque, BatchTask *task)
+{
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top) {
+		*task = deque->tasks[deque->top++];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static void addFile(FileList *list, char const *path, struct stat const *st)
+{
+	if (list->count >= list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		list->files = realloc(list->files, list->capacity * sizeof(*list->files));
+	}
+	BatchFile *file = &list->files[list->count++];
+	memset(file, 0, sizeof(*file));
+	file->path = strdup(path);
+	file->dev = st->st_dev;
+	file->ino = st->st_ino;
+	file->raw_size = st->st_size;
+	file->block_count = (st->st_size + list->block_size - 1) / list->block_size;
+	file->remaining = file->block_count;
+	file->in = -1;
+}
+
+static int hasSuffix(char const *str, char const *suffix)
+{
+	size_t len = strlen(str), slen = strlen(suffix);
+	return len >= slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+static int collect(FileList *list, char const *path, int explicit)
+{
+	struct stat st;
+	// follow the links we were handed, but not the ones we find while walking:
+	// a link back up the tree would otherwise have us walk it forever.
+	if ((explicit ? stat(path, &st) : lstat(path, &st)) != 0) {
+		fprintf(stderr, "cannot access %s.\n", path);
+		return 1;
+	}
+	if (S_ISREG(st.st_mode)) {
+		// don't pick up our own output when a directory is packed twice.
+		if (explicit || !hasSuffix(path, BATCH_SUFFIX))
+			addFile(list, path, &st);
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode)) return 0;
+
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		fprintf(stderr, "cannot open directory %s.\n", path);
+		return 1;
+	}
+	int failures = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+		char *child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		sprintf(child, "%s/%s", path, entry->d_name);
+		failures += collect(list, child, 0);
+		free(child);
+	}
+	closedir(dir);
+	return failures;
+}
+
+static int compareFiles(void const *a, void const *b)
+{
+	BatchFile const *x = a, *y = b;
+	if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+	if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+	return 0;
+}
+
+// the same file named twice (or reached through two paths) must only be packed once,
+// or two tasks would be writing the same output.
+static void dropDuplicates(FileList *list)
+{
+	qsort(list->files, list->count, sizeof(*list->files), compareFiles);
+	size_t kept = 0;
+	for (size_t f = 0; f < list->count; ++f) {
+		if (kept > 0 && compareFiles(&list->files[kept - 1], &list->files[f]) == 0) {
+			free(list->files[f].path);
+			continue;
+		}
+		list->files[kept++] = list->files[f];
+	}
+	list->count = kept;
+}
+
+static char *outputPath(BatchFile const *file)
+{
+	char *outpath = malloc(strlen(file->path) + sizeof(BATCH_SUFFIX));
+	sprintf(outpath, "%s" BATCH_SUFFIX, file->path);
+	return outpath;
+}
+
+// called with the file's lock held.
+static void openFile(BatchFile *file)
+{
+	if (file->in >= 0 || file->out != NULL || file->failed) return;
+	file->in = open(file->path, O_RDONLY);
+	if (file->in < 0) {
+		fprintf(stderr, "cannot read %s.\n", file->path);
+		file->failed = 1;
+		return;
+	}
+	char *outpath = outputPath(file);
+	file->out = fopen(outpath, "wb");
+	if (file->out == NULL) {
+		fprintf(stderr, "cannot write %s.\n", outpath);
+		file->failed = 1;
+	}
+	free(outpath);
+	file->blocks = calloc(file->block_count, sizeof(*file->blocks));
+	file->spilled = malloc(file->block_count * sizeof(*file->spilled));
+	for (uint32_t b = 0; b < file->block_count; ++b)
+		file->spilled[b] = -1;
+}
+
+// called with the file's lock held; takes ownership of data.
+static void placeBlock(BatchFile *file, uint32_t b, char *data)
+{
+	uint32_t const size = file->blocks[b].size;
+	if (b != file->next) {
+		if (file->spill == NULL) file->spill = tmpfile();
+		if (file->spill == NULL || pwrite(fileno(file->spill), data, size, file->spill_size) != (ssize_t) size) {
+			fprintf(stderr, "cannot spill %s.\n", file->path);
+			file->failed = 1;
+		}
+		file->spilled[b] = file->spill_size;
+		file->spill_size += size;
+		free(data);
+		return;
+	}
+
+	fwrite(data, 1, size, file->out);
+	free(data);
+	// bring in whatever was waiting on this block.
+	while (++file->next < file->block_count && file->spilled[file->next] >= 0) {
+		uint32_t const wsize = file->blocks[file->next].size;
+		char *waiting = malloc(wsize);
+		if (pread(fileno(file->spill), waiting, wsize, file->spilled[file->next]) != (ssize_t) wsize) {
+			fprintf(stderr, "cannot spill %s.\n", file->path);
+			file->failed = 1;
+		}
+		fwrite(waiting, 1, wsize, file->out);
+		free(waiting);
+	}
+}
+
+static void finishFile(BatchPool *pool, BatchFile *file)
+{
+	if (file->block_count == 0) openFile(file);
+	if (file->out != NULL) {
+		int const wrote = !file->failed;
+		if (wrote) writePackIndex(file->out, file->blocks, file->block_count, file->raw_size, pool->block_size, pool->flags);
+		int const bad = ferror(file->out);
+		if (fclose(file->out) != 0 || bad) file->failed = 1;
+		char *outpath = outputPath(file);
+		if (wrote && file->failed) fprintf(stderr, "cannot write %s.\n", outpath);
+		// don't leave a truncated pack behind that looks like a finished one.
+		if (file->failed) remove(outpath);
+		free(outpath);
+	}
+	if (file->in >= 0) close(file->in);
+	if (file->spill != NULL) fclose(file->spill);
+	if (file->failed)
+		__atomic_add_fetch(&pool->failures, 1, __ATOMIC_RELAXED);
+
+	free(file->blocks);
+	free(file->spilled);
+	file->blocks = NULL;
+	file->spilled = NULL;
+}
+
+static void runTask(BatchPool *pool, BatchTask task, unsigned char *raw)
+{
+	BatchFile *file = task.file;
+	Count const offset = (Count) task.block * pool->block_size;
+	size_t len = file->raw_size - offset < pool->block_size ? file->raw_size - offset : pool->block_size;
+
+	pthread_mutex_lock(&file->lock);
+	openFile(file);
+	int const in = file->failed ? -1 : file->in;
+	pthread_mutex_unlock(&file->lock);
+
+	if (in >= 0) {
+		if (pread(in, raw, len, offset) == (ssize_t) len) {
+			PackedBlock block;
+			packBlock(pool->chain, raw, len, pool->flags, &block);
+			pthread_mutex_lock(&file->lock);
+			file->blocks[task.block].size = block.size;
+			file->blocks[task.block].checksum = block.checksum;
+			if (!file->failed) placeBlock(file, task.block, block.data);
+			else free(block.data);
+			pthread_mutex_unlock(&file->lock);
+		} else {
+			pthread_mutex_lock(&file->lock);
+			if (!file->failed) fprintf(stderr, "cannot read %s.\n", file->path);
+			file->failed = 1;
+			pthread_mutex_unlock(&file->lock);
+		}
+	}
+
+	// the acquire-release makes every other block's result visible to the finisher.
+	if (__atomic_sub_fetch(&file->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+		pthread_mutex_lock(&file->lock);
+		finishFile(pool, file);
+		pthread_mutex_unlock(&file->lock);
+	}
+}
+
+static void *workerMain(void *ud)
+{
+	BatchWorker *worker = ud;
+	BatchPool *pool = worker->pool;
+	unsigned char *raw = malloc(pool->block_size);
+	for (;;) {
+		BatchTask task;
+		int found = popTask(&pool->deques[worker->id], &task);
+		for (int k = 1; !found && k < pool->nworkers; ++k)
+			found = stealTask(&pool->deques[(worker->id + k) % pool->nworkers], &task);
+		if (!found) break;
+		runTask(pool, task, raw);
+	}
+	free(raw);
+	return NULL;
+}
+
+int batchPack(Chain const *chain, char **paths, int count, uint32_t block_size, unsigned flags, int threads)
+{
+	FileList list = {NULL, 0, 0, block_size};
+	int failures = 0;
+	for (int i = 0; i < count; ++i)
+		failures += collect(&list, paths[i], 1);
+	dropDuplicates(&list);
+
+	if (threads < 1) threads = 1;
+	BatchPool pool = {chain, block_size, flags, calloc(threads, sizeof(TaskDeque)), threads, 0};
+	for (int w = 0; w < threads; ++w)
+		pthread_mutex_init(&pool.deques[w].lock, NULL);
+
+	// hand out whole files round-robin; stealing evens out the rest.
+	// The owner pops from the bottom, so push the blocks back to front to have
+	// them come out in order and go straight to the output.
+	for (size_t f = 0; f < list.count; ++f) {
+		BatchFile *file = &list.files[f];
+		pthread_mutex_init(&file->lock, NULL);
+		if (file->block_count == 0) {
+			finishFile(&pool, file);
+			continue;
+		}
+		for (uint32_t b = file->block_count; b-- > 0;)
+			pushTask(&pool.deques[f % threads], (BatchTask) {file, b});
+	}
+
+	BatchWorker *workers = calloc(threads, sizeof(*workers));
+	for (int w = 0; w < threads; ++w)
+		workers[w] = (BatchWorker) {&pool, w, 0};
+	for (int w = 1; w < threads; ++w)
+		pthread_create(&workers[w].thread, NULL, workerMain, &workers[w]);
+	workerMain(&workers[0]);
+	for (int w = 1; w < threads; ++w)
+		pthread_join(workers[w].thread, NULL);
+
+	for (int w = 0; w < threads; ++w) {
+		pthread_mutex_destroy(&pool.deques[w].lock);
+		free(pool.deques[w].tasks);
+	}
+	for (size_t f = 0; f < list.count; ++f) {
+		pthread_mutex_destroy(&list.files[f].lock);
+		free(list.files[f].path);
+	}
+	free(list.files);
+	free(workers);
+	free(pool.deques);
+	return failures + pool.failures;
+}
@@ -0,0 +1,42 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+// depends on stdio.h
+// depends on stdint.h
+// depends on bitstream.h
+// depends on base.h
+// depends on chain.h
+
+#ifdef CMPLAB_BATCH_H
+#error multiple inclusion
+#endif
+#define CMPLAB_BATCH_H
+
+/* Packs every file in paths (directories are walked recursively) into
+ * <file>.cmp. Every block of every file is a separate task for a pool of
+ * threads with one work-stealing deque each, so a single large file still
+ * keeps all threads busy. Finished blocks go to the output as soon as the
+ * ones before them are out, so memory stays at a few blocks per thread no
+ * matter how large the files are. Symbolic links found while walking are
+ * not followed. Returns the number of files that failed. */
+int batchPack(Chain const *chain, char **paths, int count, uint32_t block_size, unsigned flags, int threads);
@@ -22,16 +22,20 @@
  ****/
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "bitstream.h"
 
 static void flushReadBuffer(Bitstream *bs)
 {
-	unsigned long d1 = fgetc(bs->file);
-	unsigned long d2 = fgetc(bs->file);
-	unsigned long d3 = fgetc(bs->file);
-	unsigned long d4 = fgetc(bs->file);
-	bs->buf_bits = (d1 << 24) | (d2 << 16) | (d3 << 8) | d4;
+	// one call per word; bytes past the end read as EOF, like fgetc would give them.
+	unsigned char word[4];
+	size_t len = fread(word, 1, 4, bs->file);
+	unsigned long d[4];
+	for (size_t i = 0; i < 4; ++i)
+		d[i] = i < len ? word[i] : (unsigned long) EOF;
+	bs->buf_bits = (d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
 	bs->buf_cur = 0;
 }
 
@@ -49,13 +53,13 @@ static void readBitsRecursive(Bitstream *bs,
 		flushReadBuffer(bs);
 		readBitsRecursive(bs, count - left, shift + left, bits);
 	} else {
-		unsigned long mask = (1 << count) - 1;
+		unsigned long mask = (1UL << count) - 1;
 		*bits |= ((bs->buf_bits >> bs->buf_cur) & mask) << shift;
 		bs->buf_cur += count;
 	}
 }
 
-unsigned long bitstreamReadBits(Bitstream *bs, int count)
+unsigned long bitstreamReadBitsSpill(Bitstream *bs, int count)
 {
 	unsigned long bits = 0;
 	readBitsRecursive(bs, count, 0, &bits);
@@ -64,23 +68,24 @@ unsigned long bitstreamReadBits(Bitstream *bs, int count)
 
 static void flushWriteBuffer(Bitstream *bs)
 {
-	fputc(bs->buf_bits >> 24, bs->file);
-	fputc((bs->buf_bits >> 16) & 0xFF, bs->file);
-	fputc((bs->buf_bits >> 8) & 0xFF, bs->file);
-	fputc(bs->buf_bits & 0xFF, bs->file);
+	unsigned char word[4] = {
+		bs->buf_bits >> 24, (bs->buf_bits >> 16) & 0xFF,
+		(bs->buf_bits >> 8) & 0xFF, bs->buf_bits & 0xFF,
+	};
+	fwrite(word, 1, 4, bs->file);
 	bs->buf_bits = 0;
 	bs->buf_cur = 0;
 }
 
-void bitstreamWriteBits(Bitstream *bs, int count, unsigned long bits)
+void bitstreamWriteBitsSpill(Bitstream *bs, int count, unsigned long bits)
 {
 	int left = 32 - bs->buf_cur;
 	if (left < count) {
 		bs->buf_bits |= bits << bs->buf_cur;
 		flushWriteBuffer(bs);
-		bitstreamWriteBits(bs, count - left, bits >> left);
+		bitstreamWriteBitsSpill(bs, count - left, bits >> left);
 	} else {
-		unsigned long mask = (1 << count) - 1;
+		unsigned long mask = (1UL << count) - 1;
 		bs->buf_bits |= (bits & mask) << bs->buf_cur;
 		bs->buf_cur += count;
 	}
@@ -90,3 +95,98 @@ void bitstreamFlushWrite(Bitstream *bs)
 {
 	flushWriteBuffer(bs);
 }
+
+void bitstreamAlignWrite(Bitstream *bs)
+{
+	if (bs->buf_cur > 0) flushWriteBuffer(bs);
+}
+
+void bitstreamAlignRead(Bitstream *bs)
+{
+	bs->buf_cur = 32; // the next read fetches a new word
+}
+
+void bitstreamCopyWords(Bitstream *out, FILE *in)
+{
+	if (out->buf_cur > 0 && out->buf_cur < 32) {
+		unsigned char word[4];
+		while (fread(word, 1, 4, in) == 4)
+			bitstreamWriteBits(out, 32, (unsigned long) word[0] << 24 | word[1] << 16 | word[2] << 8 | word[3]);
+		return;
+	}
+	// on a word boundary the bytes can go through as they are, all but the
+	// last word, which stays behind as if it had just been written.
+	unsigned char buf[1 << 16];
+	size_t have = 0, len;
+	while ((len = fread(buf + have, 1, sizeof(buf) - have, in)) > 0) {
+		have += len;
+		if (have > 4) {
+			if (out->buf_cur == 32) flushWriteBuffer(out);
+			fwrite(buf, 1, have - 4, out->file);
+			memmove(buf, buf + have - 4, 4);
+			have = 4;
+		}
+	}
+	if (have == 4) {
+		if (out->buf_cur == 32) flushWriteBuffer(out);
+		out->buf_bits = (unsigned long) buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+		out->buf_cur = 32;
+	}
+}
+
+static void writeWide(Bitstream *bs, int count, uint64_t bits)
+{
+	while (count > 32) {
+		bitstreamWriteBits(bs, 32, bits & 0xFFFFFFFF);
+		bits >>= 32;
+		count -= 32;
+	}
+	bitstreamWriteBits(bs, count, bits);
+}
+
+static uint64_t readWide(Bitstream *bs, int count)
+{
+	uint64_t bits = 0;
+	int shift = 0;
+	while (count > 32) {
+		bits |= (uint64_t) bitstreamReadBits(bs, 32) << shift;
+		shift += 32;
+		count -= 32;
+	}
+	return bits | (uint64_t) bitstreamReadBits(bs, count) << shift;
+}
+
+void bitstreamWriteGamma(Bitstream *bs, uint64_t value)
+{
+	int k = 63 - __builtin_clzll(value);
+	writeWide(bs, k, 0);
+	bitstreamWriteBits(bs, 1, 1);
+	writeWide(bs, k, value); // the top bit is implied by the prefix
+}
+
+int bitstreamGammaLength(uint64_t value)
+{
+	return 2 * (63 - __builtin_clzll(value)) + 1;
+}
+
+uint64_t bitstreamReadGamma(Bitstream *bs)
+{
+	// count the zero prefix a buffer at a time instead of bit by bit.
+	int k = 0;
+	for (;;) {
+		int left = 32 - bs->buf_cur;
+		unsigned long avail = left > 0 ? (bs->buf_bits >> bs->buf_cur) & ((1UL << left) - 1) : 0;
+		if (avail != 0) {
+			int zeros = __builtin_ctzl(avail);
+			k += zeros;
+			bs->buf_cur += zeros + 1;
+			break;
+		}
+		k += left;
+		if (k > 63) return 0;
+		flushReadBuffer(bs);
+		if (feof(bs->file)) return 0;
+	}
+	if (k > 63) return 0;
+	return (UINT64_C(1) << k) | readWide(bs, k);
+}
@@ -22,6 +22,7 @@
  ****/
 
 // depends on stdio.h
+// depends on stdint.h
 
 #ifdef CMPLAB_BITSTREAM_H
 #error multiple inclusion
@@ -35,7 +36,44 @@ typedef struct {
 } Bitstream;
 
 void bitstreamFlushRead(Bitstream *bs);
-unsigned long bitstreamReadBits(Bitstream *bs, int count);
-
-void bitstreamWriteBits(Bitstream *bs, int count, unsigned long bits);
 void bitstreamFlushWrite(Bitstream *bs);
+
+/* Finish the current word, so that whole bytes can go straight to or come
+ * straight from the file in their original order; bit reading and writing
+ * pick up with a fresh word afterwards. Both sides have to align at the same
+ * point, after at least one bit since the start or the last alignment. */
+void bitstreamAlignWrite(Bitstream *bs);
+void bitstreamAlignRead(Bitstream *bs);
+
+/* Appends the flushed bitstream in to out, as if its words had been written
+ * to out one by one. The stream in has to be whole words. */
+void bitstreamCopyWords(Bitstream *out, FILE *in);
+
+/* Reading and writing within the current word is inlined, so callers that
+ * pass a constant count get its masks and bounds folded into their loops.
+ * Crossing into the next word goes through these. */
+unsigned long bitstreamReadBitsSpill(Bitstream *bs, int count);
+void bitstreamWriteBitsSpill(Bitstream *bs, int count, unsigned long bits);
+
+static inline unsigned long bitstreamReadBits(Bitstream *bs, int count)
+{
+	if (32 - bs->buf_cur < count) return bitstreamReadBitsSpill(bs, count);
+	unsigned long bits = (bs->buf_bits >> bs->buf_cur) & ((1UL << count) - 1);
+	bs->buf_cur += count;
+	return bits;
+}
+
+static inline void bitstreamWriteBits(Bitstream *bs, int count, unsigned long bits)
+{
+	if (32 - bs->buf_cur < count) {
+		bitstreamWriteBitsSpill(bs, count, bits);
+		return;
+	}
+	bs->buf_bits |= (bits & ((1UL << count) - 1)) << bs->buf_cur;
+	bs->buf_cur += count;
+}
+
+/* Elias gamma codes for values >= 1. Reading returns 0 on a malformed code or EOF. */
+void bitstreamWriteGamma(Bitstream *bs, uint64_t value);
+uint64_t bitstreamReadGamma(Bitstream *bs);
+int bitstreamGammaLength(uint64_t value); // in bits
@@ -0,0 +1,200 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for fopencookie
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+
+/* Every chain starts with the exact length of every stream it goes through,
+ * the input being the first one: decoders can't tell their padding apart
+ * from real data, so each stage's output is cut to its recorded length. */
+
+static void writeLength(Bitstream *out, Count len)
+{
+	bitstreamWriteBits(out, 32, (uint64_t) len >> 32);
+	bitstreamWriteBits(out, 32, (uint64_t) len & 0xFFFFFFFF);
+}
+
+static Count readLength(Bitstream *in)
+{
+	uint64_t hi = bitstreamReadBits(in, 32);
+	uint64_t lo = bitstreamReadBits(in, 32);
+	return (hi << 32) | lo;
+}
+
+/* What is left of in, or -1 if in can't seek. */
+static Count inputLength(FILE *in)
+{
+	long start = ftell(in);
+	if (start < 0 || fseek(in, 0, SEEK_END) != 0) return -1;
+	Count len = ftell(in) - start;
+	fseek(in, start, SEEK_SET);
+	return len;
+}
+
+typedef struct {
+	FILE *in;
+	Count count;
+} CountingReader;
+
+static ssize_t countRead(void *cookie, char *buf, size_t size)
+{
+	CountingReader *reader = cookie;
+	size_t n = fread(buf, 1, size, reader->in);
+	reader->count += n;
+	return n;
+}
+
+/* Runs every stage but the last, storing the length of every stream it
+ * produces after the input's. Returns the input of the last stage, which the
+ * caller closes unless it is in. */
+static FILE *encodeStages(Chain const *chain, FILE *in, Count lens[CHAIN_MAX_STAGES])
+{
+	int const last = chain->count - 1;
+	FILE *cur = in;
+	for (int i = 0; i < last; ++i) {
+		FILE *next = tmpfile();
+		Bitstream nextb = {next, 0, 0};
+		chain->stages[i]->encode(cur, &nextb, &chain->params[i]);
+		bitstreamFlushWrite(&nextb);
+		lens[i + 1] = ftell(next);
+		rewind(next);
+		if (cur != in) fclose(cur);
+		cur = next;
+	}
+	return cur;
+}
+
+void encodeChain(Chain const *chain, FILE *in, Bitstream *out)
+{
+	int const last = chain->count - 1;
+	Count lens[CHAIN_MAX_STAGES];
+	lens[0] = inputLength(in);
+
+	// a stream we can't seek in is measured by counting what the first stage reads.
+	CountingReader reader = {in, 0};
+	FILE *first = in;
+	if (lens[0] < 0)
+		first = fopencookie(&reader, "r", (cookie_io_functions_t) {countRead, NULL, NULL, NULL});
+
+	FILE *cur = encodeStages(chain, first, lens);
+	Algorithm const *stage = chain->stages[last];
+	if (first != in && last == 0) {
+		// the stage itself is the one reading, so its stream has to wait until the count is in.
+		FILE *tail = tmpfile();
+		Bitstream tailb = {tail, 0, 0};
+		stage->encode(first, &tailb, &chain->params[last]);
+		writeLength(out, reader.count);
+		rewind(tail);
+		bitstreamCopyWords(out, tail);
+		if (tailb.buf_cur > 0)
+			bitstreamWriteBits(out, tailb.buf_cur, tailb.buf_bits); // the word that wasn't finished
+		else if (ftell(tail) > 0)
+			bitstreamAlignWrite(out); // the stage ended on a word boundary, so it does here too
+		fclose(tail);
+	} else {
+		if (first != in) lens[0] = reader.count;
+		for (int i = 0; i <= last; ++i)
+			writeLength(out, lens[i]);
+		stage->encode(cur, out, &chain->params[last]);
+	}
+	if (cur != first) fclose(cur);
+	if (first != in) fclose(first);
+}
+
+static ssize_t countWrite(void *cookie, char const *buf, size_t size)
+{
+	(void) buf;
+	*(Count *) cookie += size;
+	return size;
+}
+
+/* For stages that can't tell their size: encode into a stream that only counts. */
+static Count countEncoded(Algorithm const *algorithm, FILE *in, Params const *params)
+{
+	Count size = 0;
+	FILE *counter = fopencookie(&size, "w", (cookie_io_functions_t) {NULL, countWrite, NULL, NULL});
+	setvbuf(counter, NULL, _IOFBF, KB(64));
+	Bitstream outb = {counter, 0, 0};
+	algorithm->encode(in, &outb, params);
+	fclose(counter); // the bits still buffered are counted below, not written
+	// a stage that ends on a word boundary still gets an empty word from the final flush.
+	if (size > 0 && outb.buf_cur == 0) return size * 8 + 32;
+	return size * 8 + outb.buf_cur;
+}
+
+Count sizeChain(Chain const *chain, FILE *in, int *exact)
+{
+	int const last = chain->count - 1;
+	Count lens[CHAIN_MAX_STAGES];
+	FILE *cur = encodeStages(chain, in, lens);
+	Count bits = 64 * chain->count;
+
+	Algorithm const *stage = chain->stages[last];
+	*exact = 1;
+	if (stage->size != NULL) {
+		bits += stage->size(cur, &chain->params[last], exact);
+	} else {
+		bits += countEncoded(stage, cur, &chain->params[last]);
+	}
+	if (cur != in) fclose(cur);
+	return bits;
+}
+
+void decodeChain(Chain const *chain, Bitstream *in, Sink *out)
+{
+	int const last = chain->count - 1;
+	Count lens[CHAIN_MAX_STAGES];
+	for (int i = 0; i <= last; ++i)
+		lens[i] = readLength(in);
+	if (feof(in->file)) return;
+
+	Bitstream *src = in;
+	Bitstream curb;
+	FILE *cur = NULL;
+	for (int i = last; i > 0; --i) {
+		FILE *next = tmpfile();
+		Sink *nexts = sinkOpenFile(next);
+		sinkLimit(nexts, lens[i]);
+		chain->stages[i]->decode(src, nexts);
+		sinkClose(nexts);
+		if (cur != NULL) fclose(cur);
+		cur = next;
+		rewind(cur);
+		curb = (Bitstream) {cur, 0, 0};
+		bitstreamFlushRead(&curb);
+		src = &curb;
+	}
+
+	// the first stage decodes straight into the output, cut off where the padding starts.
+	sinkLimit(out, lens[0]);
+	chain->stages[0]->decode(src, out);
+	sinkLimit(out, SINK_UNLIMITED);
+	if (cur != NULL) fclose(cur);
+}
@@ -0,0 +1,54 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+// depends on stdio.h
+// depends on stdint.h
+// depends on bitstream.h
+// depends on sink.h
+// depends on base.h
+
+#ifdef CMPLAB_CHAIN_H
+#error multiple inclusion
+#endif
+#define CMPLAB_CHAIN_H
+
+#define CHAIN_MAX_STAGES 8
+
+/* A chain runs several algorithms back to back, e.g. "delta:4+huff", or
+ * just one. On encode, every stage consumes the output of the one before it;
+ * on decode, the stages are undone in reverse. The stream starts with the
+ * length of the input and of every stream in between, so that what the
+ * decoders make of their padding can be cut off. */
+typedef struct {
+	Algorithm const *stages[CHAIN_MAX_STAGES];
+	Params params[CHAIN_MAX_STAGES];
+	int count;
+} Chain;
+
+void encodeChain(Chain const *chain, FILE *in, Bitstream *out);
+void decodeChain(Chain const *chain, Bitstream *in, Sink *out);
+
+/* The number of bits encodeChain would write, before padding, without writing
+ * them. Stages before the last one still have to run; the last one is only
+ * measured. Clears *exact if that measurement is an estimate. */
+Count sizeChain(Chain const *chain, FILE *in, int *exact);
@@ -0,0 +1,128 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CHECKSUM_HAVE_SSE42
+#endif
+
+#include "checksum.h"
+
+#define CRC32C_POLY 0x82F63B78 // reflected
+
+static uint32_t crcTable[8][256];
+static uint32_t (*crcUpdate)(uint32_t, unsigned char const *, size_t);
+
+static uint32_t crcSoftware(uint32_t crc, unsigned char const *p, size_t len)
+{
+	while (len > 0 && ((uintptr_t) p & 7) != 0) {
+		crc = crcTable[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		--len;
+	}
+	while (len >= 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc; // little-endian host assumed
+		crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF]
+		    ^ crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24]
+		    ^ crcTable[3][hi & 0xFF] ^ crcTable[2][(hi >> 8) & 0xFF]
+		    ^ crcTable[1][(hi >> 16) & 0xFF] ^ crcTable[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = crcTable[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		--len;
+	}
+	return crc;
+}
+
+#ifdef CHECKSUM_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crcHardware(uint32_t crc, unsigned char const *p, size_t len)
+{
+	while (len > 0 && ((uintptr_t) p & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		--len;
+	}
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	crc = crc64;
+#endif
+	while (len >= 4) {
+		uint32_t word;
+		memcpy(&word, p, 4);
+		crc = _mm_crc32_u32(crc, word);
+		p += 4;
+		len -= 4;
+	}
+	while (len > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		--len;
+	}
+	return crc;
+}
+#endif
+
+__attribute__((constructor))
+static void initChecksum(void)
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int k = 0; k < 8; ++k)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		crcTable[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; ++i) {
+		for (int t = 1; t < 8; ++t)
+			crcTable[t][i] = (crcTable[t - 1][i] >> 8) ^ crcTable[0][crcTable[t - 1][i] & 0xFF];
+	}
+
+	crcUpdate = crcSoftware;
+#ifdef CHECKSUM_HAVE_SSE42
+	if (__builtin_cpu_supports("sse4.2"))
+		crcUpdate = crcHardware;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, void const *data, size_t len)
+{
+	return ~crcUpdate(~crc, data, len);
+}
+
+uint32_t crc32cSoftware(uint32_t crc, void const *data, size_t len)
+{
+	return ~crcSoftware(~crc, data, len);
+}
@@ -0,0 +1,37 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+// depends on stddef.h
+// depends on stdint.h
+
+#ifdef CMPLAB_CHECKSUM_H
+#error multiple inclusion
+#endif
+#define CMPLAB_CHECKSUM_H
+
+/* CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it,
+ * slicing-by-8 tables otherwise. Pass 0 as the initial crc; the result of one
+ * call can be fed into the next to checksum data piecewise. */
+uint32_t crc32c(uint32_t crc, void const *data, size_t len);
+/* Always the table-driven path, whatever the CPU, so it can be checked against the other. */
+uint32_t crc32cSoftware(uint32_t crc, void const *data, size_t len);
@@ -0,0 +1,265 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+
+/* Long-range deduplication, meant to run in front of a real coder, e.g. "dedup+lzw".
+ * The input is cut into chunks where a gear rolling hash over the last 64 bytes
+ * hits a pattern, so cut points follow the content and an insertion only moves
+ * the chunks around it. Chunks seen before, no matter how long ago, become
+ * references; everything else is passed on as literals.
+ *
+ * A literal is a zero bit, a bit telling whether it will be referenced by number
+ * later on, its gamma-coded length, padding up to the next word and then its
+ * bytes, unshifted and in order, so the next coder sees them just like the
+ * input, and zero bytes up to the next word, so the stream stays whole words.
+ * A reference is a one bit and the gamma-coded distance back in the
+ * numbered literals. Both sides keep the numbered chunks in a temporary file
+ * and only their positions in memory; the encoder stops numbering once its
+ * fingerprint table is as large as allowed. */
+
+#define DEDUP_AVG_BITS 13 // 8 KiB chunks on average at the default level
+#define DEDUP_MAX_LEN KB(512) // longest chunk the decoder accepts
+#define DEDUP_TABLE_BITS 12 // initial size of the fingerprint table
+#define DEDUP_MAX_TABLE_BITS 22
+
+typedef struct {
+	uint64_t fp; // fingerprint
+	int64_t index; // number among the kept literals, or -1 for an empty slot
+	int64_t offset; // in the chunk store
+	uint32_t len;
+} DedupEntry;
+
+typedef struct {
+	DedupEntry *slots;
+	int bits, maxbits;
+	Count count;
+} DedupTable;
+
+typedef struct {
+	int64_t offset;
+	uint32_t len;
+} DedupChunk;
+
+static void makegear(uint64_t gear[ALPHABET_SIZE])
+{
+	uint64_t x = 0;
+	for (int i = 0; i < ALPHABET_SIZE; ++i) {
+		// splitmix64
+		uint64_t z = (x += UINT64_C(0x9E3779B97F4A7C15));
+		z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+		z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+/* Returns the length of the chunk at the start of data. */
+static size_t cut(unsigned char const *data, size_t len, size_t minlen, size_t maxlen, uint64_t mask, uint64_t const *gear)
+{
+	if (len <= minlen) return len;
+	if (len > maxlen) len = maxlen;
+	uint64_t h = 0;
+	for (size_t i = minlen; i < len; ++i) {
+		h = (h << 1) + gear[data[i]];
+		if ((h & mask) == 0) return i + 1;
+	}
+	return len;
+}
+
+static uint64_t fingerprint(unsigned char const *data, size_t len)
+{
+	uint64_t h = len;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, data + i, sizeof(w));
+		h = ((h ^ w) * UINT64_C(0x9E3779B97F4A7C15));
+		h ^= h >> 29;
+	}
+	for (; i < len; ++i)
+		h = (h ^ data[i]) * UINT64_C(0x100000001B3);
+	return h ^ (h >> 32);
+}
+
+static void inittable(DedupTable *table, Count mem_budget)
+{
+	table->maxbits = DEDUP_MAX_TABLE_BITS;
+	while (mem_budget > 0 && table->maxbits > DEDUP_TABLE_BITS
+			&& (Count) sizeof(DedupEntry) << table->maxbits > mem_budget)
+		--table->maxbits;
+	table->bits = DEDUP_TABLE_BITS;
+	table->count = 0;
+	table->slots = malloc(sizeof(DedupEntry) << table->bits);
+	for (Count i = 0; i < (Count) 1 << table->bits; ++i)
+		table->slots[i].index = -1;
+}
+
+/* Returns the slot holding fp, or the empty one where it would go. */
+static DedupEntry *findslot(DedupTable const *table, uint64_t fp)
+{
+	uint64_t const mask = ((uint64_t) 1 << table->bits) - 1;
+	for (uint64_t at = fp & mask;; at = (at + 1) & mask) {
+		DedupEntry *e = &table->slots[at];
+		if (e->index < 0 || e->fp == fp) return e;
+	}
+}
+
+/* Keeps the table at most half full. Returns 0 once it can't grow any further. */
+static int makeroom(DedupTable *table)
+{
+	if (table->count < (Count) 1 << (table->bits - 1)) return 1;
+	if (table->bits == table->maxbits) return 0;
+	DedupEntry *old = table->slots;
+	Count const oldsize = (Count) 1 << table->bits;
+	++table->bits;
+	table->slots = malloc(sizeof(DedupEntry) << table->bits);
+	for (Count i = 0; i < (Count) 1 << table->bits; ++i)
+		table->slots[i].index = -1;
+	for (Count i = 0; i < oldsize; ++i)
+		if (old[i].index >= 0) *findslot(table, old[i].fp) = old[i];
+	free(old);
+	return 1;
+}
+
+static void writeliteral(Bitstream *out, unsigned char const *data, size_t len, int keep)
+{
+	bitstreamWriteBits(out, 1, 0);
+	bitstreamWriteBits(out, 1, keep);
+	bitstreamWriteGamma(out, len);
+	// the bytes go out as they are, so the coder after us sees the real data.
+	bitstreamAlignWrite(out);
+	fwrite(data, 1, len, out->file);
+	static unsigned char const zeros[4];
+	fwrite(zeros, 1, -len & 3, out->file);
+}
+
+void encode_dedup(FILE *in, Bitstream *out, Params const *params)
+{
+	// smaller chunks find more duplicates but need more table entries.
+	int const avgbits = DEDUP_AVG_BITS + (LEVEL_DEFAULT - PARAMS_LEVEL(params)) / 2;
+	size_t const minlen = (size_t) 1 << (avgbits - 2);
+	size_t const maxlen = (size_t) 1 << (avgbits + 3);
+	uint64_t const mask = (((uint64_t) 1 << avgbits) - 1) << (64 - avgbits);
+	uint64_t gear[ALPHABET_SIZE];
+	makegear(gear);
+
+	DedupTable table;
+	inittable(&table, params->mem_budget);
+	FILE *store = tmpfile();
+	int64_t stored = 0;
+
+	// buf always holds at least one chunk of the longest kind, unless the input ends first.
+	size_t const bufsize = 2 * maxlen;
+	unsigned char *buf = malloc(bufsize);
+	unsigned char *old = malloc(maxlen);
+	size_t len = fread(buf, 1, bufsize, in), pos = 0;
+	for (;;) {
+		if (len - pos < maxlen && !feof(in)) {
+			memmove(buf, buf + pos, len - pos);
+			len -= pos;
+			pos = 0;
+			len += fread(buf + len, 1, bufsize - len, in);
+		}
+		if (pos == len) break;
+		unsigned char const *chunk = buf + pos;
+		size_t n = cut(chunk, len - pos, minlen, maxlen, mask, gear);
+		pos += n;
+
+		uint64_t fp = fingerprint(chunk, n);
+		DedupEntry *e = findslot(&table, fp);
+		if (e->index >= 0) {
+			// the fingerprint only says where to look.
+			if (e->len == n && pread(fileno(store), old, n, e->offset) == (ssize_t) n
+					&& memcmp(old, chunk, n) == 0) {
+				bitstreamWriteBits(out, 1, 1);
+				bitstreamWriteGamma(out, table.count - e->index);
+			} else {
+				writeliteral(out, chunk, n, 0);
+			}
+			continue;
+		}
+		if (!makeroom(&table) || pwrite(fileno(store), chunk, n, stored) != (ssize_t) n) {
+			writeliteral(out, chunk, n, 0);
+			continue;
+		}
+		e = findslot(&table, fp);
+		*e = (DedupEntry) {fp, table.count++, stored, n};
+		stored += n;
+		writeliteral(out, chunk, n, 1);
+	}
+
+	free(old);
+	free(buf);
+	fclose(store);
+	free(table.slots);
+}
+
+void decode_dedup(Bitstream *in, Sink *out)
+{
+	FILE *store = tmpfile();
+	int64_t stored = 0;
+	DedupChunk *chunks = NULL;
+	Count count = 0, capacity = 0;
+	unsigned char *buf = malloc(DEDUP_MAX_LEN);
+
+	for (;;) {
+		int ref = bitstreamReadBits(in, 1);
+		int keep = ref ? 0 : bitstreamReadBits(in, 1);
+		uint64_t v = bitstreamReadGamma(in);
+		if (feof(in->file) || v == 0) break;
+
+		if (ref) {
+			if (v > (uint64_t) count) break;
+			DedupChunk c = chunks[count - v];
+			if (pread(fileno(store), buf, c.len, c.offset) != (ssize_t) c.len) break;
+			sinkWrite(out, buf, c.len);
+			continue;
+		}
+
+		if (v > DEDUP_MAX_LEN) break;
+		bitstreamAlignRead(in);
+		unsigned char pad[4];
+		if (fread(buf, 1, v, in->file) != v || fread(pad, 1, -v & 3, in->file) != (-v & 3)) break;
+		sinkWrite(out, buf, v);
+		if (!keep) continue;
+		if (pwrite(fileno(store), buf, v, stored) != (ssize_t) v) break;
+		if (count == capacity) {
+			capacity = capacity > 0 ? 2 * capacity : KB(4);
+			chunks = realloc(chunks, capacity * sizeof(*chunks));
+		}
+		chunks[count++] = (DedupChunk) {stored, v};
+		stored += v;
+	}
+
+	free(buf);
+	free(chunks);
+	fclose(store);
+}
@@ -0,0 +1,321 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#define DELTA_HAVE_SSE2
+#endif
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+
+/* Replaces every element of the input by its difference to the element
+ * `stride` elements before it. Elements are `width` bytes wide and are
+ * subtracted as little-endian integers with wraparound, which also works
+ * for the bit patterns of floats. Parameters are given as delta:width[:stride].
+ * A partial element at the very end of the input is treated as zero-extended;
+ * the low bytes of a difference only depend on the low bytes of its operands,
+ * so only the bytes actually present need to be stored. */
+
+#define DELTA_BLOCK KB(64) // multiple of every width and of the vector size
+#define DELTA_MAX_STRIDE 65535
+#define DELTA_LOGW_BITS 2
+#define DELTA_STRIDE_BITS 16
+
+typedef size_t (*DeltaKernel)(unsigned char *out, unsigned char const *x, unsigned char const *y, size_t len);
+typedef size_t (*ScanKernel)(unsigned char *out, unsigned char const *in, size_t len);
+
+#ifdef DELTA_HAVE_SSE2
+
+#define DELTA_SSE2_KERNELS(W, EPI) \
+	static size_t sub##W##Sse2(unsigned char *out, unsigned char const *x, unsigned char const *y, size_t len) \
+	{ \
+		size_t i = 0; \
+		for (; i + 16 <= len; i += 16) { \
+			__m128i a = _mm_loadu_si128((__m128i const *) (x + i)); \
+			__m128i b = _mm_loadu_si128((__m128i const *) (y + i)); \
+			_mm_storeu_si128((__m128i *) (out + i), _mm_sub_##EPI(a, b)); \
+		} \
+		return i; \
+	} \
+	static size_t add##W##Sse2(unsigned char *out, unsigned char const *x, unsigned char const *y, size_t len) \
+	{ \
+		size_t i = 0; \
+		for (; i + 16 <= len; i += 16) { \
+			__m128i a = _mm_loadu_si128((__m128i const *) (x + i)); \
+			__m128i b = _mm_loadu_si128((__m128i const *) (y + i)); \
+			_mm_storeu_si128((__m128i *) (out + i), _mm_add_##EPI(a, b)); \
+		} \
+		return i; \
+	}
+
+#define DELTA_AVX2_KERNEL(W, EPI) \
+	__attribute__((target("avx2"))) \
+	static size_t sub##W##Avx2(unsigned char *out, unsigned char const *x, unsigned char const *y, size_t len) \
+	{ \
+		size_t i = 0; \
+		for (; i + 32 <= len; i += 32) { \
+			__m256i a = _mm256_loadu_si256((__m256i const *) (x + i)); \
+			__m256i b = _mm256_loadu_si256((__m256i const *) (y + i)); \
+			_mm256_storeu_si256((__m256i *) (out + i), _mm256_sub_##EPI(a, b)); \
+		} \
+		return i; \
+	}
+
+DELTA_SSE2_KERNELS(1, epi8)
+DELTA_SSE2_KERNELS(2, epi16)
+DELTA_SSE2_KERNELS(4, epi32)
+DELTA_SSE2_KERNELS(8, epi64)
+
+DELTA_AVX2_KERNEL(1, epi8)
+DELTA_AVX2_KERNEL(2, epi16)
+DELTA_AVX2_KERNEL(4, epi32)
+DELTA_AVX2_KERNEL(8, epi64)
+
+/* Undoing a stride-1 delta is a prefix sum. Within a vector it takes
+ * log2(16 / width) shifted adds, plus the last sum of the previous vector. */
+
+static size_t scan1Sse2(unsigned char *out, unsigned char const *in, size_t len)
+{
+	__m128i carry = _mm_set1_epi8(out[-1]);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i const *) (in + i));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi8(x, carry);
+		_mm_storeu_si128((__m128i *) (out + i), x);
+		__m128i t = _mm_shufflehi_epi16(_mm_unpackhi_epi8(x, x), 0xFF);
+		carry = _mm_shuffle_epi32(t, 0xFF);
+	}
+	return i;
+}
+
+static size_t scan2Sse2(unsigned char *out, unsigned char const *in, size_t len)
+{
+	uint16_t last;
+	memcpy(&last, out - 2, sizeof(last));
+	__m128i carry = _mm_set1_epi16(last);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i const *) (in + i));
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi16(x, carry);
+		_mm_storeu_si128((__m128i *) (out + i), x);
+		carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(x, 0xFF), 0xFF);
+	}
+	return i;
+}
+
+static size_t scan4Sse2(unsigned char *out, unsigned char const *in, size_t len)
+{
+	uint32_t last;
+	memcpy(&last, out - 4, sizeof(last));
+	__m128i carry = _mm_set1_epi32(last);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i const *) (in + i));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, carry);
+		_mm_storeu_si128((__m128i *) (out + i), x);
+		carry = _mm_shuffle_epi32(x, 0xFF);
+	}
+	return i;
+}
+
+static size_t scan8Sse2(unsigned char *out, unsigned char const *in, size_t len)
+{
+	uint64_t last;
+	memcpy(&last, out - 8, sizeof(last));
+	__m128i carry = _mm_set1_epi64x(last);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i const *) (in + i));
+		x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi64(x, carry);
+		_mm_storeu_si128((__m128i *) (out + i), x);
+		carry = _mm_unpackhi_epi64(x, x);
+	}
+	return i;
+}
+
+static DeltaKernel subKernels[4] = {sub1Sse2, sub2Sse2, sub4Sse2, sub8Sse2};
+static DeltaKernel const addKernels[4] = {add1Sse2, add2Sse2, add4Sse2, add8Sse2};
+static ScanKernel const scanKernels[4] = {scan1Sse2, scan2Sse2, scan4Sse2, scan8Sse2};
+
+__attribute__((constructor))
+static void initDelta(void)
+{
+	if (__builtin_cpu_supports("avx2")) {
+		subKernels[0] = sub1Avx2;
+		subKernels[1] = sub2Avx2;
+		subKernels[2] = sub4Avx2;
+		subKernels[3] = sub8Avx2;
+	}
+}
+
+#endif
+
+#define DELTA_LOOP(T, OP) \
+	for (; i < len; i += sizeof(T)) { \
+		T a, b; \
+		memcpy(&a, x + i, sizeof(T)); \
+		memcpy(&b, y + i, sizeof(T)); \
+		a = a OP b; \
+		memcpy(out + i, &a, sizeof(T)); \
+	}
+
+/* out = x - y, elementwise. len has to be a multiple of the width. */
+static void forward(int logw, unsigned char *out, unsigned char const *x, unsigned char const *y, size_t len)
+{
+	size_t i = 0;
+#ifdef DELTA_HAVE_SSE2
+	i = subKernels[logw](out, x, y, len);
+#endif
+	switch (logw) {
+	case 0: DELTA_LOOP(uint8_t,  -) break;
+	case 1: DELTA_LOOP(uint16_t, -) break;
+	case 2: DELTA_LOOP(uint32_t, -) break;
+	case 3: DELTA_LOOP(uint64_t, -) break;
+	}
+}
+
+/* out = x + out[-lag], elementwise. */
+static void inverse(int logw, size_t lag, unsigned char *out, unsigned char const *x, size_t len)
+{
+	unsigned char const *y = out - lag;
+	size_t i = 0;
+#ifdef DELTA_HAVE_SSE2
+	if (lag >= 16) {
+		i = addKernels[logw](out, x, y, len);
+	} else if (lag == (size_t) 1 << logw) {
+		i = scanKernels[logw](out, x, len);
+	}
+#endif
+	switch (logw) {
+	case 0: DELTA_LOOP(uint8_t,  +) break;
+	case 1: DELTA_LOOP(uint16_t, +) break;
+	case 2: DELTA_LOOP(uint32_t, +) break;
+	case 3: DELTA_LOOP(uint64_t, +) break;
+	}
+}
+
+static int parsedelta(char const *arg, int *logw, int *stride)
+{
+	*logw = 0;
+	*stride = 1;
+	if (arg == NULL) return 0;
+	char *end;
+	long width = strtol(arg, &end, 10);
+	long s = 1;
+	if (*end == ':') s = strtol(end + 1, &end, 10);
+	if (*end != '\0' || s < 1 || s > DELTA_MAX_STRIDE) return -1;
+	switch (width) {
+	case 1: *logw = 0; break;
+	case 2: *logw = 1; break;
+	case 4: *logw = 2; break;
+	case 8: *logw = 3; break;
+	default: return -1;
+	}
+	*stride = s;
+	return 0;
+}
+
+static size_t roundup(size_t len, int logw)
+{
+	size_t const mask = ((size_t) 1 << logw) - 1;
+	return (len + mask) & ~mask;
+}
+
+static size_t readblock(FILE *in, unsigned char *buf)
+{
+	size_t len = 0, got;
+	while (len < DELTA_BLOCK && (got = fread(buf + len, 1, DELTA_BLOCK - len, in)) > 0)
+		len += got;
+	return len;
+}
+
+void encode_delta(FILE *in, Bitstream *out, Params const *params)
+{
+	int logw, stride;
+	if (parsedelta(params->arg, &logw, &stride) != 0) {
+		fprintf(stderr, "incorrect delta parameters.\n");
+		exit(EXIT_FAILURE);
+	}
+	bitstreamWriteBits(out, DELTA_LOGW_BITS, logw);
+	bitstreamWriteBits(out, DELTA_STRIDE_BITS, stride);
+
+	// buf holds the last lag input bytes followed by the current block.
+	size_t const lag = (size_t) stride << logw;
+	unsigned char *buf = calloc(lag + DELTA_BLOCK, 1);
+	unsigned char *res = malloc(DELTA_BLOCK);
+	for (;;) {
+		size_t len = readblock(in, buf + lag);
+		if (len == 0) break;
+		size_t whole = roundup(len, logw);
+		memset(buf + lag + len, 0, whole - len);
+		forward(logw, res, buf + lag, buf, whole);
+		for (size_t i = 0; i < len; ++i)
+			bitstreamWriteBits(out, 8, res[i]);
+		memmove(buf, buf + len, lag);
+	}
+	free(res);
+	free(buf);
+}
+
+void decode_delta(Bitstream *in, Sink *out)
+{
+	int logw = bitstreamReadBits(in, DELTA_LOGW_BITS);
+	int stride = bitstreamReadBits(in, DELTA_STRIDE_BITS);
+	if (feof(in->file) || stride < 1) return;
+
+	// buf holds the last lag output bytes followed by the current block.
+	size_t const lag = (size_t) stride << logw;
+	unsigned char *buf = calloc(lag + DELTA_BLOCK, 1);
+	unsigned char *res = malloc(DELTA_BLOCK);
+	size_t len;
+	do {
+		for (len = 0; len < DELTA_BLOCK; ++len) {
+			res[len] = bitstreamReadBits(in, 8);
+			if (feof(in->file)) break;
+		}
+		size_t whole = roundup(len, logw);
+		memset(res + len, 0, whole - len);
+		inverse(logw, lag, buf + lag, res, whole);
+		sinkWrite(out, buf + lag, len);
+		memmove(buf, buf + len, lag);
+	} while (len == DELTA_BLOCK);
+	free(res);
+	free(buf);
+}
@@ -24,18 +24,44 @@
 #define _GNU_SOURCE // for qsort_r
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "bitstream.h"
+#include "sink.h"
 #include "base.h"
 
-static void countfreqs(FILE *in, Count freqs[ALPHABET_SIZE])
+/* Symbols are either bytes or, with "huff:16", little-endian 16-bit words
+ * (an odd trailing byte is zero-extended). Most of the 65536 words never
+ * occur in practice, so everything past the histogram only deals with the
+ * symbols that do: the header lists them with their code lengths, and the
+ * tree is built over them alone. */
+
+#define HUFF_MAX_LEN 24 // has to fit into HUFF_LEN_BITS
+#define HUFF_LEN_BITS 5
+#define HUFF_LOOKUP_BITS 12 // decode table of 16 KiB, codes up to this long take a single lookup
+
+static int symbolwidth(Params const *params)
 {
-	for (Symbol sym = 0; sym < ALPHABET_SIZE; ++sym)
-		freqs[sym] = 0;
-	for (;;) {
-		Symbol sym = fgetc(in);
-		if (feof(in)) break;
-		++freqs[sym];
+	if (params->arg == NULL || strcmp(params->arg, "8") == 0) return 8;
+	if (strcmp(params->arg, "16") == 0) return 16;
+	fprintf(stderr, "incorrect huff parameters.\n");
+	exit(EXIT_FAILURE);
+}
+
+static void countfreqs(FILE *in, int width, Count *freqs)
+{
+	unsigned char buf[KB(64)];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (width == 8) {
+			for (size_t i = 0; i < n; ++i)
+				++freqs[buf[i]];
+			continue;
+		}
+		if (n % 2 != 0) buf[n++] = 0; // only ever at the very end
+		for (size_t i = 0; i < n; i += 2)
+			++freqs[buf[i] | buf[i + 1] << 8];
 	}
 }
 
@@ -60,34 +86,33 @@ static void percdown(hf_queue q, Count at, Synsym sym)
 {
 	Count const left  = 2 * at + 1;
 	Count const right = 2 * at + 2;
-	if (left < q.count && q.freqs[sym] > q.freqs[q.heap[left]]) {
-		q.heap[at] = q.heap[left];
-		percdown(q, left, sym);
-	} else if (right < q.count && q.freqs[sym] > q.freqs[q.heap[right]]) {
-		q.heap[at] = q.heap[right];
-		percdown(q, right, sym);
+	Count child = left;
+	if (right < q.count && q.freqs[q.heap[right]] < q.freqs[q.heap[left]])
+		child = right;
+	if (child < q.count && q.freqs[sym] > q.freqs[q.heap[child]]) {
+		q.heap[at] = q.heap[child];
+		percdown(q, child, sym);
 	} else {
 		q.heap[at] = sym;
 	}
 }
 
-static Count freq2hier(Count sfreqs[ALPHABET_SIZE], Symbol hier[ALPHABET_SIZE * 2 - 1])
+/* leaves are 0 to nleaves - 1, inner nodes follow. Returns the node count. */
+static Count freq2hier(Count nleaves, Count const *lfreqs, Synsym *hier)
 {
-	Synsym heap[ALPHABET_SIZE];
-	Count freqs[ALPHABET_SIZE * 2 - 1];
-	for (Symbol i = 0; i < ALPHABET_SIZE; ++i)
-		freqs[i] = sfreqs[i];
+	Synsym *heap = malloc(nleaves * sizeof(*heap));
+	Count *freqs = malloc((2 * nleaves - 1) * sizeof(*freqs));
+	for (Synsym i = 0; i < nleaves; ++i)
+		freqs[i] = lfreqs[i];
 	hf_queue q = {freqs, heap, 0};
-	for (Symbol sym = 0; sym < ALPHABET_SIZE; ++sym) {
-		if (freqs[sym] == 0) continue;
-		q.heap[q.count++] = sym;
-	}
+	for (Synsym i = 0; i < nleaves; ++i)
+		q.heap[q.count++] = i;
 	for (Count i = q.count / 2 - 1; i >= 0; --i)
 		percdown(q, i, q.heap[i]);
 
-	for (Synsym i = 0; i < ALPHABET_SIZE * 2 - 1; ++i)
+	for (Synsym i = 0; i < 2 * nleaves - 1; ++i)
 		hier[i] = -1;
-	Count ncount = ALPHABET_SIZE; // node count
+	Count ncount = nleaves; // node count
 	while (q.count > 1) {
 		Synsym first  = q.heap[0];
 		percdown(q, 0, q.heap[--q.count]);
@@ -99,82 +124,355 @@ static Count freq2hier(Count sfreqs[ALPHABET_SIZE], Symbol hier[ALPHABET_SIZE *
 		hier[second] = new;
 		percup(q, q.count++, new);
 	}
+	free(freqs);
+	free(heap);
 	return ncount;
 }
 
-static void hier2len(Synsym hier[ALPHABET_SIZE * 2 - 1], Count ncount, int len[ALPHABET_SIZE])
+static void hier2len(Count nleaves, Synsym const *hier, Count ncount, int *len)
 {
-	int depth[ALPHABET_SIZE * 2 - 1];
-	depth[ncount - 1] = 1;
-	for (int i = ncount - 2; i >= 0; --i) {
-		if (hier[i] < 0) {
-			depth[i] = -1;
-		} else {
-			depth[i] = depth[hier[i]] + 1;
-		}
-	}
-	for (int i = ncount - 1; i < ALPHABET_SIZE; ++i)
-		depth[i] = -1;
-	for (int i = 0; i < ALPHABET_SIZE; ++i)
+	int *depth = malloc(ncount * sizeof(*depth));
+	depth[ncount - 1] = 0; // the root
+	for (Count i = ncount - 2; i >= 0; --i)
+		depth[i] = depth[hier[i]] + 1;
+	for (Count i = 0; i < nleaves; ++i)
 		len[i] = depth[i];
+	free(depth);
+}
+
+static void freq2len(Count nleaves, Count const *freqs, int *len)
+{
+	if (nleaves == 1) {
+		// a single symbol has no tree at all, but still needs a code.
+		len[0] = 1;
+		return;
+	}
+	Count *scaled = malloc(nleaves * sizeof(*scaled));
+	Synsym *hier = malloc((2 * nleaves - 1) * sizeof(*hier));
+	memcpy(scaled, freqs, nleaves * sizeof(*scaled));
+	for (;;) {
+		Count ncount = freq2hier(nleaves, scaled, hier);
+		hier2len(nleaves, hier, ncount, len);
+
+		int maxlen = 0;
+		for (Count i = 0; i < nleaves; ++i)
+			if (len[i] > maxlen) maxlen = len[i];
+		if (maxlen <= HUFF_MAX_LEN) break;
+
+		// flatten the distribution until the tree is shallow enough.
+		for (Count i = 0; i < nleaves; ++i)
+			scaled[i] = (scaled[i] + 1) / 2;
+	}
+	free(hier);
+	free(scaled);
+}
+
+/* The code of a Huffman table, over its used symbols in ascending order. */
+typedef struct {
+	Count count;
+	Symbol *syms;
+	int *len;
+	unsigned long *code; // bit-reversed, ready to be written
+	Count *order; // indices sorted by code length, then symbol
+} HuffTable;
+
+static void inittable(HuffTable *table, Count count)
+{
+	table->count = count;
+	table->syms  = malloc(count * sizeof(*table->syms));
+	table->len   = malloc(count * sizeof(*table->len));
+	table->code  = malloc(count * sizeof(*table->code));
+	table->order = malloc(count * sizeof(*table->order));
+}
+
+static void freetable(HuffTable *table)
+{
+	free(table->syms);
+	free(table->len);
+	free(table->code);
+	free(table->order);
 }
 
 static int symlen_compare(void const *ap, void const *bp, void *ud)
 {
 	int *len = ud;
-	Symbol as = * (Symbol *) ap;
-	Symbol bs = * (Symbol *) bp;
-	int ld = len[as] - len[bs];
+	Count a = * (Count *) ap;
+	Count b = * (Count *) bp;
+	int ld = len[a] - len[b];
 	if (ld != 0) {
 		return ld;
 	} else {
-		return as - bs;
+		return a < b ? -1 : a > b;
 	}
 }
 
-static void symsbylen(int len[ALPHABET_SIZE], Symbol syms[ALPHABET_SIZE])
+static unsigned long reversebits(unsigned long code, int len)
 {
-	// TODO filter out unused symbols before sorting
-	for (Symbol sym = 0; sym < ALPHABET_SIZE; ++sym)
-		syms[sym] = sym;
-	qsort_r(syms, ALPHABET_SIZE, sizeof(*syms), symlen_compare, len);
+	unsigned long rev = 0;
+	for (int i = 0; i < len; ++i) {
+		rev = (rev << 1) | (code & 1);
+		code >>= 1;
+	}
+	return rev;
 }
 
-static void len2code(Symbol syms[ALPHABET_SIZE], int len[ALPHABET_SIZE], unsigned long code[ALPHABET_SIZE])
+/* Assigns canonical codes. The bitstream is filled from the least significant
+ * bit upwards, but canonical codes have to be read starting with their top bit,
+ * so they are stored reversed. */
+static void len2code(HuffTable *table)
 {
-	Symbol sym_start = 0;
-	while (len[syms[sym_start]] < 0) ++sym_start;
+	for (Count i = 0; i < table->count; ++i)
+		table->order[i] = i;
+	qsort_r(table->order, table->count, sizeof(*table->order), symlen_compare, table->len);
 
 	unsigned long next = 0;
-	int prev_len = len[syms[sym_start]];
-	for (Symbol i = sym_start; i < ALPHABET_SIZE; ++i) {
-		Symbol sym = syms[i];
-		next <<= len[sym] - prev_len;
-		code[sym] = next++;
-		prev_len = len[sym];
-	}
-}
-
-void encode_huff(FILE *in, Bitstream *out, Bitstream *table)
-{
-	Count freqs[ALPHABET_SIZE];
-	Synsym hier[ALPHABET_SIZE * 2 - 1];
-	int len[ALPHABET_SIZE];
-	Symbol syms[ALPHABET_SIZE];
-	countfreqs(stdin, freqs);
-	int ncount = freq2hier(freqs, hier);
-	hier2len(hier, ncount, len);
-	// TODO output table
-	(void) table;
-
-	rewind(in);
-	symsbylen(len, syms);
-	unsigned long code[ALPHABET_SIZE];
-	len2code(syms, len, code);
+	int prev_len = table->count > 0 ? table->len[table->order[0]] : 0;
+	for (Count i = 0; i < table->count; ++i) {
+		Count u = table->order[i];
+		next <<= table->len[u] - prev_len;
+		table->code[u] = reversebits(next++, table->len[u]);
+		prev_len = table->len[u];
+	}
+}
+
+static void writetable(Bitstream *out, int width, HuffTable const *table)
+{
+	bitstreamWriteBits(out, 1, width == 16);
+	bitstreamWriteGamma(out, table->count + 1);
+	Symbol prev = -1;
+	for (Count i = 0; i < table->count; ++i) {
+		bitstreamWriteGamma(out, table->syms[i] - prev);
+		bitstreamWriteBits(out, HUFF_LEN_BITS, table->len[i]);
+		prev = table->syms[i];
+	}
+}
+
+static int readtable(Bitstream *in, int *width, HuffTable *table)
+{
+	*width = bitstreamReadBits(in, 1) ? 16 : 8;
+	uint64_t count = bitstreamReadGamma(in);
+	if (count == 0 || count - 1 > (UINT64_C(1) << *width)) return -1;
+	inittable(table, count - 1);
+	Symbol prev = -1;
+	for (Count i = 0; i < table->count; ++i) {
+		uint64_t delta = bitstreamReadGamma(in);
+		table->len[i] = bitstreamReadBits(in, HUFF_LEN_BITS);
+		if (feof(in->file) || delta == 0 || prev + delta >= (UINT64_C(1) << *width)
+		    || table->len[i] < 1 || table->len[i] > HUFF_MAX_LEN) {
+			freetable(table);
+			return -1;
+		}
+		table->syms[i] = prev += delta;
+	}
+	len2code(table);
+	return 0;
+}
+
+/* Combined codes for every pair of bytes, indexed by first | second << 8,
+ * so the encoder can emit two symbols with one write. Pairs whose codes
+ * don't fit into a single write keep a length of zero. */
+typedef struct {
+	uint32_t code[ALPHABET_SIZE * ALPHABET_SIZE];
+	unsigned char len[ALPHABET_SIZE * ALPHABET_SIZE];
+} HuffPairs;
+
+static void pairtable(unsigned char const *len, uint32_t const *code, HuffPairs *pairs)
+{
+	for (Symbol second = 0; second < ALPHABET_SIZE; ++second) {
+		for (Symbol first = 0; first < ALPHABET_SIZE; ++first) {
+			unsigned pair = first | second << 8;
+			int l = len[first] + len[second];
+			if (len[first] == 0 || len[second] == 0 || l > 32) {
+				pairs->len[pair] = 0;
+				continue;
+			}
+			pairs->len[pair] = l;
+			pairs->code[pair] = code[first] | code[second] << len[first];
+		}
+	}
+}
+
+static void encodebytes(FILE *in, Bitstream *out, unsigned char const *len, uint32_t const *code)
+{
+	HuffPairs *pairs = malloc(sizeof(*pairs));
+	pairtable(len, code, pairs);
+	unsigned char buf[KB(64)];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		size_t i = 0;
+		for (; i + 1 < n; i += 2) {
+			unsigned pair = buf[i] | buf[i + 1] << 8;
+			if (pairs->len[pair] > 0) {
+				bitstreamWriteBits(out, pairs->len[pair], pairs->code[pair]);
+			} else {
+				bitstreamWriteBits(out, len[buf[i]], code[buf[i]]);
+				bitstreamWriteBits(out, len[buf[i + 1]], code[buf[i + 1]]);
+			}
+		}
+		if (i < n)
+			bitstreamWriteBits(out, len[buf[i]], code[buf[i]]);
+	}
+	free(pairs);
+}
+
+static void encodewords(FILE *in, Bitstream *out, unsigned char const *len, uint32_t const *code)
+{
+	unsigned char buf[KB(64)];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (n % 2 != 0) buf[n++] = 0;
+		for (size_t i = 0; i < n; i += 2) {
+			Symbol sym = buf[i] | buf[i + 1] << 8;
+			bitstreamWriteBits(out, len[sym], code[sym]);
+		}
+	}
+}
+
+/* Counts the input and gives every symbol that occurs a code length.
+ * Returns the frequencies of the used symbols, in table order. */
+static Count *buildtable(FILE *in, int width, HuffTable *table)
+{
+	Count const nsyms = (Count) 1 << width;
+	Count *freqs = calloc(nsyms, sizeof(*freqs));
+	countfreqs(in, width, freqs);
+
+	Count used = 0;
+	for (Symbol sym = 0; sym < nsyms; ++sym)
+		if (freqs[sym] > 0) ++used;
+	inittable(table, used);
+	Count *ufreqs = malloc(used * sizeof(*ufreqs));
+	used = 0;
+	for (Symbol sym = 0; sym < nsyms; ++sym) {
+		if (freqs[sym] == 0) continue;
+		table->syms[used] = sym;
+		ufreqs[used++] = freqs[sym];
+	}
+	free(freqs);
+	if (used > 0) freq2len(used, ufreqs, table->len);
+	return ufreqs;
+}
+
+void encode_huff(FILE *in, Bitstream *out, Params const *params)
+{
+	int const width = symbolwidth(params);
+	Count const nsyms = (Count) 1 << width;
+	long start = ftell(in);
+	HuffTable table;
+	free(buildtable(in, width, &table));
+	len2code(&table);
+	writetable(out, width, &table);
+
+	// dense lookup for the hot loop; a length of zero marks unused symbols.
+	unsigned char *len = calloc(nsyms, sizeof(*len));
+	uint32_t *code = calloc(nsyms, sizeof(*code));
+	for (Count i = 0; i < table.count; ++i) {
+		len[table.syms[i]] = table.len[i];
+		code[table.syms[i]] = table.code[i];
+	}
+	freetable(&table);
+
+	fseek(in, start, SEEK_SET);
+	if (width == 8) {
+		encodebytes(in, out, len, code);
+	} else {
+		encodewords(in, out, len, code);
+	}
+	free(code);
+	free(len);
+}
+
+Count size_huff(FILE *in, Params const *params, int *exact)
+{
+	int const width = symbolwidth(params);
+	HuffTable table;
+	Count *ufreqs = buildtable(in, width, &table);
+
+	// the same fields writetable puts down, then every symbol at its code length.
+	Count bits = 1 + bitstreamGammaLength(table.count + 1);
+	Symbol prev = -1;
+	for (Count i = 0; i < table.count; ++i) {
+		bits += bitstreamGammaLength(table.syms[i] - prev) + HUFF_LEN_BITS;
+		bits += ufreqs[i] * table.len[i];
+		prev = table.syms[i];
+	}
+	free(ufreqs);
+	freetable(&table);
+	*exact = 1;
+	return bits;
+}
+
+/* The decode loop looks at up to 64 bits at once, more than the bitstream can
+ * hand out without consuming them, so it takes over the rest of the stream
+ * and reads the same big-endian words itself. */
+typedef struct {
+	FILE *file;
+	uint64_t bits;
+	int avail;
+} HuffReader;
+
+static void refill(HuffReader *r)
+{
+	while (r->avail <= 32) {
+		unsigned char b[4];
+		if (fread(b, 1, 4, r->file) < 4) return;
+		uint64_t word = (uint32_t) b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+		r->bits |= word << r->avail;
+		r->avail += 32;
+	}
+}
+
+void decode_huff(Bitstream *in, Sink *out)
+{
+	int width;
+	HuffTable table;
+	if (readtable(in, &width, &table) != 0) return;
+
+	// canonical codes of one length are consecutive, so all the slow path
+	// needs per length is the first code and where its symbols start.
+	unsigned long first[HUFF_MAX_LEN + 1];
+	Count count[HUFF_MAX_LEN + 1] = {0};
+	Count start[HUFF_MAX_LEN + 1];
+	for (Count i = table.count - 1; i >= 0; --i) {
+		Count u = table.order[i];
+		first[table.len[u]] = reversebits(table.code[u], table.len[u]);
+		start[table.len[u]] = i;
+		++count[table.len[u]];
+	}
+	// every short code fills all the lookup entries it is a prefix of.
+	uint32_t *lookup = calloc(1 << HUFF_LOOKUP_BITS, sizeof(*lookup));
+	for (Count u = 0; u < table.count; ++u) {
+		if (table.len[u] > HUFF_LOOKUP_BITS) continue;
+		for (uint32_t fill = 0; fill < 1u << (HUFF_LOOKUP_BITS - table.len[u]); ++fill)
+			lookup[table.code[u] | fill << table.len[u]] = table.syms[u] | (uint32_t) table.len[u] << 16;
+	}
+
+	HuffReader r = {in->file, (in->buf_bits >> in->buf_cur) & ((1UL << (32 - in->buf_cur)) - 1), 32 - in->buf_cur};
 	for (;;) {
-		Symbol sym = fgetc(in);
-		if (feof(in)) break;
+		refill(&r);
+		Symbol sym;
+		uint32_t entry = lookup[r.bits & ((1 << HUFF_LOOKUP_BITS) - 1)];
+		int l = entry >> 16;
+		if (l > 0) {
+			sym = entry & 0xFFFF;
+		} else {
+			unsigned long c = 0;
+			l = 0;
+			do {
+				if (l >= HUFF_MAX_LEN) goto done; // not a valid code
+				c = (c << 1) | ((r.bits >> l) & 1);
+				++l;
+			} while (count[l] == 0 || c - first[l] >= (unsigned long) count[l]);
+			sym = table.syms[table.order[start[l] + (c - first[l])]];
+		}
+		if (l > r.avail) break; // ran into the end of the stream
+		r.bits >>= l;
+		r.avail -= l;
 
-		bitstreamWriteBits(out, len[sym], code[sym]);
+		sinkPutc(out, sym & 0xFF);
+		if (width == 16) sinkPutc(out, sym >> 8);
 	}
+
+done:
+	free(lookup);
+	freetable(&table);
 }
@@ -23,109 +23,376 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "bitstream.h"
+#include "sink.h"
 #include "base.h"
 
-#define LZW_DICT_SIZE 65536
+/* The largest code width follows from the level and the memory budget, and
+ * is stored in a small header along with the reset policy. Once the
+ * dictionary is full, the fast levels start over with a fresh one right away:
+ * the encoder right after adding the last entry, the decoder (which always
+ * lags one entry behind) just before reading the next code. The slow levels
+ * keep using the full dictionary for as long as it pays off, and only start
+ * over once the bytes covered per code drop noticeably below the best stretch
+ * seen so far. Both sides track that the same way, so no signal is needed. */
 
-typedef int LzwIdx;
+#define LZW_MIN_BITS 9
+#define LZW_MAX_BITS 24
+#define LZW_WIDTH_BITS 5
+#define LZW_ENTRY_COST 16 // bytes per dictionary entry on the encoder side, including the hash table
+#define LZW_ADAPTIVE_LEVEL 7 // from here on, full dictionaries are kept until they stop paying off
+#define LZW_WINDOW 4096 // codes per measurement of a full dictionary
+#define LZW_SAMPLE_CHUNK KB(512) // enough to fill a dictionary of the default width
+#define LZW_SAMPLE_CHUNKS 8
+
+typedef int32_t LzwIdx;
 
 typedef struct {
 	LzwIdx prefix;
 	Symbol suffix;
 } lzw_word;
 
-static LzwIdx initdict(lzw_word dict[LZW_DICT_SIZE])
+typedef struct {
+	Count codes, bytes; // in the current window
+	Count best; // most bytes any window covered so far
+} lzw_window;
+
+static int maxbitsfor(Params const *params)
+{
+	int bits = 11 + PARAMS_LEVEL(params); // 16 bits at the default level
+	if (params->mem_budget > 0) {
+		while (bits > LZW_MIN_BITS && ((Count) LZW_ENTRY_COST << bits) > params->mem_budget) --bits;
+	}
+	return bits;
+}
+
+static LzwIdx initdict(lzw_word *dict, int *bitsize)
 {
 	for (Symbol sym = 0; sym < ALPHABET_SIZE; ++sym)
 		dict[sym] = (lzw_word){-1, sym};
+	*bitsize = 1;
+	while (ALPHABET_SIZE >> *bitsize > 0) ++*bitsize;
 	return ALPHABET_SIZE;
 }
 
-static LzwIdx findword(lzw_word dict[LZW_DICT_SIZE], LzwIdx top, LzwIdx index, Symbol sym)
+/* Accounts for one more code of a full dictionary and tells whether it's time to start over. */
+static int worsened(lzw_window *window, Count wordlen)
 {
-	for (LzwIdx i = 0; i < top; ++i) {
-		if (dict[i].prefix != index) continue;
-		if (dict[i].suffix != sym) continue;
-		return i;
-	}
-	return -1;
+	window->bytes += wordlen;
+	if (++window->codes < LZW_WINDOW) return 0;
+	Count bytes = window->bytes;
+	window->codes = window->bytes = 0;
+	if (bytes > window->best) window->best = bytes;
+	return bytes < window->best - window->best / 8;
 }
 
-void encode_lzw(FILE *in, Bitstream *out)
+static uint32_t hashword(LzwIdx index, Symbol sym, int hashbits)
 {
-	lzw_word dict[LZW_DICT_SIZE];
-	LzwIdx top = initdict(dict);
+	return ((uint32_t) index * 256 + sym) * 2654435761u >> (32 - hashbits);
+}
 
-	int bitsize = 1;
-	while (ALPHABET_SIZE >> bitsize > 0) ++bitsize;
+/* open addressing over twice as many slots as there are dictionary entries. */
+static LzwIdx findword(lzw_word const *dict, LzwIdx const *hash, int hashbits, LzwIdx index, Symbol sym, uint32_t *slot)
+{
+	uint32_t const mask = (1u << hashbits) - 1;
+	uint32_t h = hashword(index, sym, hashbits);
+	for (;; h = (h + 1) & mask) {
+		LzwIdx i = hash[h];
+		if (i < 0 || (dict[i].prefix == index && dict[i].suffix == sym)) {
+			*slot = h;
+			return i;
+		}
+	}
+}
 
-	LzwIdx index = fgetc(in);
-	if (feof(in)) return;
+/* Both loops come in one version per code width, so that the bitstream gets
+ * constant widths and only has to check for the end of the input when a
+ * code crosses into the next word. They return whenever the width changes,
+ * and the caller carries on with the loop for the new one. Widths beyond
+ * LZW_KERNEL_BITS are rare enough to share a loop that takes it at runtime. */
 
-	for (;;) {
-		Symbol sym = fgetc(in);
-		if (feof(in)) break;
+#define LZW_KERNEL_BITS 16
+#define LZW_BUFFER_SIZE KB(64)
 
-		LzwIdx succ = findword(dict, top, index, sym);
+enum { LZW_DONE, LZW_WIDER, LZW_RESTART };
 
-		if (succ >= 0) {
-			index = succ;
-		} else {
-			dict[top++] = (lzw_word) {index, sym};
-			bitstreamWriteBits(out, bitsize, index);
-			index = sym;
+typedef struct {
+	FILE *in;
+	Bitstream *out;
+	unsigned char *buf;
+	size_t pos, len;
+	lzw_word *dict;
+	LzwIdx *hash;
+	int hashbits, maxbits, adaptive, bitsize;
+	LzwIdx limit, top, index;
+	Count wordlen;
+	lzw_window window;
+} LzwEncoder;
 
-			if (top >= (1 << bitsize) - 1) {
-				++bitsize;
-			}
-		}
+#define LZW_ENCODE_KERNEL(NAME, W) \
+	static int NAME(LzwEncoder *e) \
+	{ \
+		lzw_word *const dict = e->dict; \
+		LzwIdx *const hash = e->hash; \
+		LzwIdx top = e->top, index = e->index; \
+		Count wordlen = e->wordlen; \
+		int status = LZW_DONE; \
+		for (;;) { \
+			if (e->pos == e->len) { \
+				e->len = fread(e->buf, 1, LZW_BUFFER_SIZE, e->in); \
+				e->pos = 0; \
+				if (e->len == 0) break; \
+			} \
+			Symbol sym = e->buf[e->pos++]; \
+			uint32_t slot; \
+			LzwIdx succ = findword(dict, hash, e->hashbits, index, sym, &slot); \
+			if (succ >= 0) { \
+				index = succ; \
+				++wordlen; \
+				continue; \
+			} \
+			int const full = top == e->limit; \
+			if (!full) { \
+				hash[slot] = top; \
+				dict[top++] = (lzw_word) {index, sym}; \
+			} \
+			bitstreamWriteBits(e->out, W, index); \
+			int const wider = top >= (1 << (W)) - 1 && (W) < e->maxbits; \
+			int const reset = e->adaptive ? full && worsened(&e->window, wordlen) : top == e->limit; \
+			index = sym; \
+			wordlen = 1; \
+			if (wider || reset) { \
+				e->bitsize = (W) + wider; \
+				if (reset) { \
+					top = initdict(dict, &e->bitsize); \
+					memset(hash, -1, sizeof(*hash) << e->hashbits); \
+					e->window = (lzw_window) {0, 0, 0}; \
+				} \
+				status = LZW_WIDER; \
+				break; \
+			} \
+		} \
+		e->top = top; \
+		e->index = index; \
+		e->wordlen = wordlen; \
+		return status; \
 	}
 
-	bitstreamWriteBits(out, bitsize, index);
+LZW_ENCODE_KERNEL(encode9, 9)
+LZW_ENCODE_KERNEL(encode10, 10)
+LZW_ENCODE_KERNEL(encode11, 11)
+LZW_ENCODE_KERNEL(encode12, 12)
+LZW_ENCODE_KERNEL(encode13, 13)
+LZW_ENCODE_KERNEL(encode14, 14)
+LZW_ENCODE_KERNEL(encode15, 15)
+LZW_ENCODE_KERNEL(encode16, 16)
+LZW_ENCODE_KERNEL(encodewide, e->bitsize)
+
+static int (*const encoders[LZW_KERNEL_BITS + 1])(LzwEncoder *) = {
+	[9] = encode9, [10] = encode10, [11] = encode11, [12] = encode12,
+	[13] = encode13, [14] = encode14, [15] = encode15, [16] = encode16,
+};
+
+void encode_lzw(FILE *in, Bitstream *out, Params const *params)
+{
+	LzwEncoder e;
+	e.in = in;
+	e.out = out;
+	e.maxbits = maxbitsfor(params);
+	e.adaptive = PARAMS_LEVEL(params) >= LZW_ADAPTIVE_LEVEL;
+	e.limit = (LzwIdx) 1 << e.maxbits;
+	e.hashbits = e.maxbits + 1;
+	e.dict = malloc(e.limit * sizeof(*e.dict));
+	e.hash = malloc(sizeof(*e.hash) << e.hashbits);
+	memset(e.hash, -1, sizeof(*e.hash) << e.hashbits);
+	e.window = (lzw_window) {0, 0, 0};
+	e.top = initdict(e.dict, &e.bitsize);
+
+	bitstreamWriteBits(out, LZW_WIDTH_BITS, e.maxbits);
+	bitstreamWriteBits(out, 1, e.adaptive);
+
+	e.buf = malloc(LZW_BUFFER_SIZE);
+	e.len = fread(e.buf, 1, LZW_BUFFER_SIZE, in);
+	if (e.len > 0) {
+		e.index = e.buf[0];
+		e.pos = 1;
+		e.wordlen = 1;
+		while ((e.bitsize <= LZW_KERNEL_BITS ? encoders[e.bitsize] : encodewide)(&e) != LZW_DONE)
+			;
+		bitstreamWriteBits(out, e.bitsize, e.index);
+	}
+	free(e.buf);
+	free(e.hash);
+	free(e.dict);
 }
 
-static Symbol firstsym(lzw_word dict[LZW_DICT_SIZE], LzwIdx idx)
+/* Encodes the rest of in into memory and returns how many bits that took. */
+static Count encodedbits(FILE *in, Params const *params)
 {
-	if (dict[idx].prefix < 0)
-		return dict[idx].suffix;
-	else
-		return firstsym(dict, dict[idx].prefix);
+	char *buf;
+	size_t size;
+	FILE *encoded = open_memstream(&buf, &size);
+	Bitstream outb = {encoded, 0, 0};
+	encode_lzw(in, &outb, params);
+	fclose(encoded); // the bits still buffered are counted below, not written
+	free(buf);
+	return (Count) size * 8 + outb.buf_cur;
 }
 
-static void fputword(lzw_word dict[LZW_DICT_SIZE], LzwIdx idx, FILE *out)
+static Count samplebits(unsigned char *sample, size_t len, Params const *params)
 {
-	if (idx < 0) return;
-	fputword(dict, dict[idx].prefix, out);
-	fputc(dict[idx].suffix, out);
+	FILE *in = fmemopen(sample, len, "rb");
+	Count bits = encodedbits(in, params);
+	fclose(in);
+	return bits;
 }
 
-void decode_lzw(Bitstream *in, FILE *out)
+/* There is no shortcut to how well LZW does short of running it, so large
+ * inputs are estimated from evenly spaced chunks. These run through a single
+ * dictionary, as the whole input would; the first chunk only warms it up
+ * and the rest give the rate for everything after the start. */
+Count size_lzw(FILE *in, Params const *params, int *exact)
 {
-	lzw_word dict[LZW_DICT_SIZE];
-	LzwIdx top = initdict(dict);
+	long start = ftell(in);
+	long len = -1;
+	if (start >= 0 && fseek(in, 0, SEEK_END) == 0)
+		len = ftell(in) - start;
+	if (len < 0 || len <= LZW_SAMPLE_CHUNK * LZW_SAMPLE_CHUNKS) {
+		if (len >= 0) fseek(in, start, SEEK_SET);
+		*exact = 1;
+		return encodedbits(in, params);
+	}
 
-	int bitsize = 1;
-	while (ALPHABET_SIZE >> bitsize > 0) ++bitsize;
+	unsigned char *sample = malloc(LZW_SAMPLE_CHUNK * LZW_SAMPLE_CHUNKS);
+	size_t got = 0;
+	for (int c = 0; c < LZW_SAMPLE_CHUNKS; ++c) {
+		fseek(in, start + (len - LZW_SAMPLE_CHUNK) / (LZW_SAMPLE_CHUNKS - 1) * c, SEEK_SET);
+		got += fread(sample + got, 1, LZW_SAMPLE_CHUNK, in);
+	}
+	Count warmup = samplebits(sample, LZW_SAMPLE_CHUNK, params);
+	Count total = samplebits(sample, got, params);
+	free(sample);
+	*exact = 0;
+	return warmup + (Count) ((double) (total - warmup) * (len - LZW_SAMPLE_CHUNK) / (got - LZW_SAMPLE_CHUNK));
+}
 
-	LzwIdx index = bitstreamReadBits(in, bitsize);
-	if (feof(in->file)) return;
-	fputword(dict, index, out);
+static Symbol firstsym(lzw_word const *dict, LzwIdx idx)
+{
+	while (dict[idx].prefix >= 0)
+		idx = dict[idx].prefix;
+	return dict[idx].suffix;
+}
 
-	for (;;) {
-		LzwIdx succ = bitstreamReadBits(in, bitsize);
-		if (feof(in->file)) break;
+/* words can get as long as the dictionary is big, so no recursion here.
+ * scratch has room for the longest word, which gets spelled backwards from its end. */
+static Count putword(lzw_word const *dict, LzwIdx idx, unsigned char *scratch, LzwIdx limit, Sink *out)
+{
+	unsigned char *p = scratch + limit;
+	for (; idx >= 0; idx = dict[idx].prefix)
+		*--p = dict[idx].suffix;
+	sinkWrite(out, p, scratch + limit - p);
+	return scratch + limit - p;
+}
 
-		Symbol sym = firstsym(dict, succ < top ? succ : index);
-		dict[top++] = (lzw_word) {index, sym};
+typedef struct {
+	Bitstream *in;
+	Sink *out;
+	lzw_word *dict;
+	unsigned char *scratch;
+	int maxbits, adaptive, bitsize;
+	LzwIdx limit, top, index;
+	lzw_window window;
+} LzwDecoder;
 
-		if (top >= (1 << bitsize) - 2) {
-			++bitsize;
-		}
+#define LZW_DECODE_KERNEL(NAME, W) \
+	static int NAME(LzwDecoder *d) \
+	{ \
+		lzw_word *const dict = d->dict; \
+		LzwIdx const limit = d->limit; \
+		LzwIdx top = d->top, index = d->index; \
+		int status = LZW_DONE; \
+		for (;;) { \
+			if (!d->adaptive && top == limit - 1) { \
+				status = LZW_RESTART; \
+				break; \
+			} \
+			int const spill = 32 - d->in->buf_cur < (W); \
+			LzwIdx succ = bitstreamReadBits(d->in, W); \
+			if (spill && feof(d->in->file)) break; \
+			/* corrupt stream; don't walk off the dictionary */ \
+			if (succ > top || succ >= limit) break; \
+			if (top < limit) { \
+				Symbol sym = firstsym(dict, succ < top ? succ : index); \
+				dict[top++] = (lzw_word) {index, sym}; \
+			} \
+			Count wordlen = putword(dict, succ, d->scratch, limit, d->out); \
+			index = succ; \
+			/* our dictionary fills up one code after the encoder's, */ \
+			/* which is exactly when the encoder starts measuring. */ \
+			if (d->adaptive && top == limit && worsened(&d->window, wordlen)) { \
+				status = LZW_RESTART; \
+				break; \
+			} \
+			if (top >= (1 << (W)) - 2 && (W) < d->maxbits) { \
+				d->bitsize = (W) + 1; \
+				status = LZW_WIDER; \
+				break; \
+			} \
+		} \
+		d->top = top; \
+		d->index = index; \
+		return status; \
+	}
+
+LZW_DECODE_KERNEL(decode9, 9)
+LZW_DECODE_KERNEL(decode10, 10)
+LZW_DECODE_KERNEL(decode11, 11)
+LZW_DECODE_KERNEL(decode12, 12)
+LZW_DECODE_KERNEL(decode13, 13)
+LZW_DECODE_KERNEL(decode14, 14)
+LZW_DECODE_KERNEL(decode15, 15)
+LZW_DECODE_KERNEL(decode16, 16)
+LZW_DECODE_KERNEL(decodewide, d->bitsize)
+
+static int (*const decoders[LZW_KERNEL_BITS + 1])(LzwDecoder *) = {
+	[9] = decode9, [10] = decode10, [11] = decode11, [12] = decode12,
+	[13] = decode13, [14] = decode14, [15] = decode15, [16] = decode16,
+};
+
+void decode_lzw(Bitstream *in, Sink *out)
+{
+	int const maxbits = bitstreamReadBits(in, LZW_WIDTH_BITS);
+	int const adaptive = bitstreamReadBits(in, 1);
+	if (feof(in->file)) return;
+	if (maxbits < LZW_MIN_BITS || maxbits > LZW_MAX_BITS) return;
+	LzwDecoder d;
+	d.in = in;
+	d.out = out;
+	d.maxbits = maxbits;
+	d.adaptive = adaptive;
+	d.limit = (LzwIdx) 1 << maxbits;
+	d.dict = malloc(d.limit * sizeof(*d.dict));
+	d.scratch = malloc(d.limit);
 
-		fputword(dict, succ, out);
+	for (;;) {
+		// at the start, and whenever the encoder has started over with a fresh dictionary.
+		d.top = initdict(d.dict, &d.bitsize);
+		d.window = (lzw_window) {0, 0, 0};
+		d.index = bitstreamReadBits(in, d.bitsize);
+		if (feof(in->file)) break;
+		if (d.index >= d.top) break; // corrupt stream
+		putword(d.dict, d.index, d.scratch, d.limit, out);
 
-		index = succ;
+		int status;
+		do {
+			status = (d.bitsize <= LZW_KERNEL_BITS ? decoders[d.bitsize] : decodewide)(&d);
+		} while (status == LZW_WIDER);
+		if (status == LZW_DONE) break;
 	}
+
+	free(d.scratch);
+	free(d.dict);
 }
@@ -0,0 +1,257 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for fmemopen & open_memstream
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+#include "pack.h"
+#include "checksum.h"
+
+#define PACK_MAGIC 0x434D504B // "CMPK"
+#define PACK_TRAILER_SIZE 24
+
+typedef struct {
+	Count raw_size;
+	uint32_t block_size;
+	uint32_t block_count;
+	unsigned flags;
+	long *offsets; // block_count + 1 entries, absolute file positions
+	uint32_t *checksums; // only with PACK_CHECKSUM
+} PackIndex;
+
+static void putU32(FILE *out, uint32_t v)
+{
+	fputc(v >> 24, out);
+	fputc((v >> 16) & 0xFF, out);
+	fputc((v >> 8) & 0xFF, out);
+	fputc(v & 0xFF, out);
+}
+
+static void putU64(FILE *out, uint64_t v)
+{
+	putU32(out, v >> 32);
+	putU32(out, v & 0xFFFFFFFF);
+}
+
+static uint32_t getU32(unsigned char const *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint64_t getU64(unsigned char const *p)
+{
+	return ((uint64_t) getU32(p) << 32) | getU32(p + 4);
+}
+
+static void encodeBlock(Chain const *chain,
+	unsigned char *raw, size_t rawlen, char **cbuf, size_t *clen)
+{
+	FILE *in = fmemopen(raw, rawlen, "r");
+	FILE *out = open_memstream(cbuf, clen);
+	Bitstream outb = {out, 0, 0};
+	encodeChain(chain, in, &outb);
+	bitstreamFlushWrite(&outb);
+	fclose(in);
+	fclose(out);
+}
+
+static void decodeBlock(Chain const *chain,
+	unsigned char *cbuf, size_t clen, char **rbuf, size_t *rlen)
+{
+	FILE *in = fmemopen(cbuf, clen, "r");
+	FILE *out = open_memstream(rbuf, rlen);
+	Sink *sink = sinkOpenFile(out);
+	Bitstream inb = {in, 0, 0};
+	bitstreamFlushRead(&inb);
+	decodeChain(chain, &inb, sink);
+	sinkClose(sink);
+	fclose(in);
+	fclose(out);
+}
+
+void packBlock(Chain const *chain, unsigned char *raw, size_t rawlen, unsigned flags, PackedBlock *block)
+{
+	block->checksum = 0;
+	if (flags & PACK_CHECKSUM)
+		block->checksum = crc32c(0, raw, rawlen); // while the block is still hot in cache
+
+	size_t clen;
+	encodeBlock(chain, raw, rawlen, &block->data, &clen);
+	block->size = clen;
+}
+
+void writePackIndex(FILE *out, PackedBlock const *blocks, uint32_t count, Count raw_size, uint32_t block_size, unsigned flags)
+{
+	for (uint32_t i = 0; i < count; ++i) {
+		putU32(out, blocks[i].size);
+		if (flags & PACK_CHECKSUM) putU32(out, blocks[i].checksum);
+	}
+	putU64(out, raw_size);
+	putU32(out, block_size);
+	putU32(out, count);
+	putU32(out, flags);
+	putU32(out, PACK_MAGIC);
+}
+
+uint32_t packBlockSize(int level, Count mem_budget)
+{
+	if (level <= 0) level = LEVEL_DEFAULT;
+	uint32_t block_size = (uint32_t) PACK_BLOCK_SIZE << level >> LEVEL_DEFAULT;
+	if (block_size < PACK_MIN_BLOCK_SIZE) block_size = PACK_MIN_BLOCK_SIZE;
+	// raw block, encoded block and the memory stream growing behind it.
+	while (mem_budget > 0 && block_size > PACK_MIN_BLOCK_SIZE && (Count) block_size * 8 > mem_budget) block_size /= 2;
+	return block_size;
+}
+
+int packStream(Chain const *chain, FILE *in, FILE *out, uint32_t block_size, unsigned flags)
+{
+	unsigned char *raw = malloc(block_size);
+	PackedBlock *blocks = NULL;
+	uint32_t count = 0, capacity = 0;
+	Count raw_size = 0;
+	for (;;) {
+		size_t rawlen = fread(raw, 1, block_size, in);
+		if (rawlen == 0) break;
+
+		if (count >= capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			blocks = realloc(blocks, capacity * sizeof(*blocks));
+		}
+		PackedBlock *block = &blocks[count++];
+		packBlock(chain, raw, rawlen, flags, block);
+		fwrite(block->data, 1, block->size, out);
+		free(block->data);
+		block->data = NULL;
+		raw_size += rawlen;
+	}
+
+	writePackIndex(out, blocks, count, raw_size, block_size, flags);
+	free(blocks);
+	free(raw);
+	return ferror(out) ? -1 : 0;
+}
+
+static int readIndex(FILE *in, PackIndex *index)
+{
+	unsigned char trailer[PACK_TRAILER_SIZE];
+	if (fseek(in, -PACK_TRAILER_SIZE, SEEK_END) != 0) return -1;
+	if (fread(trailer, 1, PACK_TRAILER_SIZE, in) != PACK_TRAILER_SIZE) return -1;
+	if (getU32(trailer + 20) != PACK_MAGIC) return -1;
+	index->raw_size    = getU64(trailer);
+	index->block_size  = getU32(trailer + 8);
+	index->block_count = getU32(trailer + 12);
+	index->flags       = getU32(trailer + 16);
+	if (index->block_size == 0) return -1;
+	// the blocks have to cover the raw size, or we'd go looking for ones that aren't there.
+	if (index->raw_size < 0 || index->raw_size > (Count) index->block_count * index->block_size) return -1;
+
+	int const entry_size = index->flags & PACK_CHECKSUM ? 8 : 4;
+	long index_pos = ftell(in) - PACK_TRAILER_SIZE - entry_size * (long) index->block_count;
+	if (index_pos < 0 || fseek(in, index_pos, SEEK_SET) != 0) return -1;
+	unsigned char *entries = malloc(entry_size * (size_t) index->block_count);
+	if (fread(entries, entry_size, index->block_count, in) != index->block_count) {
+		free(entries);
+		return -1;
+	}
+
+	index->offsets = malloc((index->block_count + 1) * sizeof(*index->offsets));
+	index->offsets[index->block_count] = index_pos;
+	for (uint32_t i = index->block_count; i > 0; --i)
+		index->offsets[i - 1] = index->offsets[i] - getU32(entries + entry_size * (i - 1));
+	if (index->flags & PACK_CHECKSUM) {
+		index->checksums = malloc(index->block_count * sizeof(*index->checksums));
+		for (uint32_t i = 0; i < index->block_count; ++i)
+			index->checksums[i] = getU32(entries + entry_size * i + 4);
+	}
+	free(entries);
+	return index->offsets[0] < 0 ? -1 : 0;
+}
+
+static void freeIndex(PackIndex *index)
+{
+	free(index->offsets);
+	free(index->checksums);
+}
+
+int extractRange(Chain const *chain, FILE *in, Sink *out, Count offset, Count length)
+{
+	PackIndex index = {0, 0, 0, 0, NULL, NULL};
+	if (readIndex(in, &index) != 0) {
+		fprintf(stderr, "input is not a valid pack stream.\n");
+		freeIndex(&index);
+		return -1;
+	}
+
+	if (offset > index.raw_size) offset = index.raw_size;
+	if (length > index.raw_size - offset) length = index.raw_size - offset;
+	Count const end = offset + length;
+
+	/* only the blocks that overlap [offset, end) are ever read or decoded. */
+	for (Count b = offset / index.block_size; b < index.block_count && b * index.block_size < end; ++b) {
+		size_t clen = index.offsets[b + 1] - index.offsets[b];
+		unsigned char *cbuf = malloc(clen);
+		if (fseek(in, index.offsets[b], SEEK_SET) != 0 || fread(cbuf, 1, clen, in) != clen) {
+			fprintf(stderr, "truncated pack stream.\n");
+			free(cbuf);
+			freeIndex(&index);
+			return -1;
+		}
+
+		char *rbuf;
+		size_t rlen;
+		decodeBlock(chain, cbuf, clen, &rbuf, &rlen);
+		free(cbuf);
+
+		/* decoders may run past the end of the block into its padding,
+		 * so the index's idea of the block size always wins. */
+		Count const block_start = b * index.block_size;
+		Count block_len = index.raw_size - block_start < index.block_size ? index.raw_size - block_start : index.block_size;
+		if (index.flags & PACK_CHECKSUM) {
+			if ((Count) rlen < block_len || crc32c(0, rbuf, block_len) != index.checksums[b]) {
+				fprintf(stderr, "checksum mismatch in block %ld.\n", (long) b);
+				free(rbuf);
+				freeIndex(&index);
+				return -1;
+			}
+		}
+		Count lo = offset > block_start ? offset - block_start : 0;
+		Count hi = end - block_start < block_len ? end - block_start : block_len;
+		if (hi > (Count) rlen) hi = rlen;
+		if (hi > lo) sinkWrite(out, rbuf + lo, hi - lo);
+		free(rbuf);
+	}
+
+	freeIndex(&index);
+	return out->error ? -1 : 0;
+}
+
+int unpackStream(Chain const *chain, FILE *in, Sink *out)
+{
+	return extractRange(chain, in, out, 0, INT64_MAX);
+}
@@ -0,0 +1,66 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+// depends on stdio.h
+// depends on stdint.h
+// depends on bitstream.h
+// depends on base.h
+// depends on chain.h
+
+#ifdef CMPLAB_PACK_H
+#error multiple inclusion
+#endif
+#define CMPLAB_PACK_H
+
+/* The pack format splits the input into blocks of block_size raw bytes
+ * and encodes each one with its own fresh codec state, so any block can be
+ * decoded without touching the ones before it. An index of compressed block
+ * sizes (and, optionally, raw block checksums) and a fixed-size trailer follow
+ * the last block. */
+
+#define PACK_BLOCK_SIZE KB(32) // at the default level
+#define PACK_MIN_BLOCK_SIZE KB(4)
+
+/* pack flags */
+#define PACK_CHECKSUM 0x1 // store a CRC32C of every raw block in the index
+
+typedef struct {
+	char *data; // compressed bytes
+	uint32_t size;
+	uint32_t checksum; // CRC32C of the raw bytes, only with PACK_CHECKSUM
+} PackedBlock;
+
+/* Building blocks for writing pack streams out of order: blocks can be packed
+ * independently, but have to be written in order, followed by the index. */
+void packBlock(Chain const *chain, unsigned char *raw, size_t rawlen, unsigned flags, PackedBlock *block);
+void writePackIndex(FILE *out, PackedBlock const *blocks, uint32_t count, Count raw_size, uint32_t block_size, unsigned flags);
+
+/* Picks the block size for a level: larger blocks compress better, smaller
+ * ones make extraction cheaper. Packing holds a few blocks' worth of buffers
+ * at once, so within a memory budget (0 for none) the blocks take about half
+ * of it and leave the rest for the codecs. */
+uint32_t packBlockSize(int level, Count mem_budget);
+
+int packStream(Chain const *chain, FILE *in, FILE *out, uint32_t block_size, unsigned flags);
+int unpackStream(Chain const *chain, FILE *in, Sink *out);
+int extractRange(Chain const *chain, FILE *in, Sink *out, Count offset, Count length);
@@ -0,0 +1,371 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for fopencookie
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+#include "pipeline.h"
+
+#define PIPE_CACHE_LINE 64
+#define PIPE_STREAM_BUFFER KB(64)
+#define PIPE_SPINS 1000 // polls before going to sleep, if there is another core to wait for
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPIN_PAUSE() __builtin_ia32_pause()
+#else
+#define SPIN_PAUSE() ((void) 0)
+#endif
+
+/* Producer and consumer each own one cache line of the ring and only ever
+ * read the other's. Positions count bytes and wrap around; the ring size is a
+ * power of two, so head - tail is always the fill level. A side that finds
+ * the ring full (or empty) spins for a while, then announces that it waits
+ * and sleeps on a futex, which the other side only bothers to wake when
+ * announced. */
+typedef struct {
+	struct {
+		uint32_t head; // bytes written so far
+		uint32_t tail_cache; // the consumer's tail when we last looked
+		uint32_t wake; // futex word the consumer sleeps on
+		int waiting; // the producer sleeps on the consumer's wake
+		int closed;
+	} __attribute__((aligned(PIPE_CACHE_LINE))) p;
+	struct {
+		uint32_t tail; // bytes read so far
+		uint32_t head_cache;
+		uint32_t wake;
+		int waiting;
+		int abandoned; // the consumer is gone; whatever comes is dropped
+	} __attribute__((aligned(PIPE_CACHE_LINE))) c;
+	unsigned char *data;
+	Count limit; // bytes the consumer gets to see, the rest is dropped
+	Count written; // bytes offered by the producer, dropped or not
+} Ring;
+
+static int spins; // set up before any stage starts
+
+static void futexWait(uint32_t *word, uint32_t value)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futexWake(uint32_t *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Called after changing anything the other side may be waiting for. */
+static void notify(int *waiting, uint32_t *wake)
+{
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+		__atomic_add_fetch(wake, 1, __ATOMIC_SEQ_CST);
+		futexWake(wake);
+	}
+}
+
+/* Waits until ready(ring) holds. The wake word is read before the final check,
+ * so an update that slips in between makes the futex call return at once. */
+static void await(Ring *ring, int (*ready)(Ring *), int *waiting, uint32_t *wake)
+{
+	for (int i = 0; i < spins; ++i) {
+		if (ready(ring)) return;
+		SPIN_PAUSE();
+	}
+	for (;;) {
+		__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+		uint32_t seen = __atomic_load_n(wake, __ATOMIC_SEQ_CST);
+		if (ready(ring)) break;
+		futexWait(wake, seen);
+	}
+	__atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+static int hasSpace(Ring *ring)
+{
+	ring->p.tail_cache = __atomic_load_n(&ring->c.tail, __ATOMIC_SEQ_CST);
+	return ring->p.head - ring->p.tail_cache < PIPE_RING_SIZE
+		|| __atomic_load_n(&ring->c.abandoned, __ATOMIC_SEQ_CST);
+}
+
+static int hasData(Ring *ring)
+{
+	ring->c.head_cache = __atomic_load_n(&ring->p.head, __ATOMIC_SEQ_CST);
+	return ring->c.head_cache != ring->c.tail
+		|| __atomic_load_n(&ring->p.closed, __ATOMIC_SEQ_CST);
+}
+
+static void ringWrite(Ring *ring, unsigned char const *data, size_t len)
+{
+	while (len > 0) {
+		uint32_t const head = ring->p.head;
+		if (head - ring->p.tail_cache == PIPE_RING_SIZE) {
+			await(ring, hasSpace, &ring->p.waiting, &ring->c.wake);
+			if (__atomic_load_n(&ring->c.abandoned, __ATOMIC_SEQ_CST)) return;
+		}
+		size_t const at = head & (PIPE_RING_SIZE - 1);
+		size_t n = PIPE_RING_SIZE - (head - ring->p.tail_cache);
+		if (n > PIPE_RING_SIZE - at) n = PIPE_RING_SIZE - at;
+		if (n > len) n = len;
+		memcpy(ring->data + at, data, n);
+		__atomic_store_n(&ring->p.head, head + n, __ATOMIC_SEQ_CST);
+		notify(&ring->c.waiting, &ring->p.wake);
+		data += n;
+		len -= n;
+	}
+}
+
+/* Blocks until there is something to read; returns 0 only at the end. */
+static size_t ringRead(Ring *ring, unsigned char *data, size_t len)
+{
+	uint32_t const tail = ring->c.tail;
+	if (ring->c.head_cache == tail) {
+		await(ring, hasData, &ring->c.waiting, &ring->p.wake);
+		if (ring->c.head_cache == tail) return 0; // closed and drained
+	}
+	size_t const at = tail & (PIPE_RING_SIZE - 1);
+	size_t n = ring->c.head_cache - tail;
+	if (n > PIPE_RING_SIZE - at) n = PIPE_RING_SIZE - at;
+	if (n > len) n = len;
+	memcpy(data, ring->data + at, n);
+	__atomic_store_n(&ring->c.tail, tail + n, __ATOMIC_SEQ_CST);
+	notify(&ring->p.waiting, &ring->c.wake);
+	return n;
+}
+
+static ssize_t ringCookieRead(void *cookie, char *buf, size_t size)
+{
+	return ringRead(cookie, (unsigned char *) buf, size);
+}
+
+static ssize_t ringCookieWrite(void *cookie, char const *buf, size_t size)
+{
+	Ring *ring = cookie;
+	Count pass = ring->limit - ring->written;
+	if (pass > (Count) size) pass = size;
+	if (pass > 0) ringWrite(ring, (unsigned char const *) buf, pass);
+	ring->written += size;
+	return size;
+}
+
+static int ringCookieCloseWrite(void *cookie)
+{
+	Ring *ring = cookie;
+	__atomic_store_n(&ring->p.closed, 1, __ATOMIC_SEQ_CST);
+	notify(&ring->c.waiting, &ring->p.wake);
+	return 0;
+}
+
+static int ringCookieCloseRead(void *cookie)
+{
+	Ring *ring = cookie;
+	__atomic_store_n(&ring->c.abandoned, 1, __ATOMIC_SEQ_CST);
+	notify(&ring->p.waiting, &ring->c.wake);
+	return 0;
+}
+
+static void initRing(Ring *ring, Count limit)
+{
+	spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? PIPE_SPINS : 0;
+	memset(ring, 0, sizeof(*ring));
+	ring->data = malloc(PIPE_RING_SIZE);
+	ring->limit = limit;
+}
+
+static FILE *openRing(Ring *ring, char const *mode)
+{
+	cookie_io_functions_t io = {NULL, NULL, NULL, NULL};
+	if (mode[0] == 'r') {
+		io.read = ringCookieRead;
+		io.close = ringCookieCloseRead;
+	} else {
+		io.write = ringCookieWrite;
+		io.close = ringCookieCloseWrite;
+	}
+	FILE *file = fopencookie(ring, mode, io);
+	setvbuf(file, NULL, _IOFBF, PIPE_STREAM_BUFFER);
+	return file;
+}
+
+typedef struct {
+	Algorithm const *algorithm;
+	Params const *params;
+	FILE *in, *out;
+	Bitstream *inb; // the last decode stage carries on with the caller's bitstream
+	int ring_in, ring_out; // whether in and out are rings, to be closed when done
+	pthread_t thread;
+} PipeStage;
+
+static void *encodeStage(void *ud)
+{
+	PipeStage *stage = ud;
+	FILE *in = stage->in;
+	if (stage->ring_in && !(stage->algorithm->flags & ALGORITHM_STREAMS)) {
+		in = tmpfile();
+		char buf[KB(64)];
+		size_t len;
+		while ((len = fread(buf, 1, sizeof(buf), stage->in)) > 0)
+			fwrite(buf, 1, len, in);
+		rewind(in);
+	}
+	Bitstream outb = {stage->out, 0, 0};
+	stage->algorithm->encode(in, &outb, stage->params);
+	bitstreamFlushWrite(&outb);
+	if (in != stage->in) fclose(in);
+	if (stage->ring_in) fclose(stage->in);
+	if (stage->ring_out) fclose(stage->out);
+	return NULL;
+}
+
+static void *decodeStage(void *ud)
+{
+	PipeStage *stage = ud;
+	Bitstream inb;
+	Bitstream *src = stage->inb;
+	if (src == NULL) {
+		inb = (Bitstream) {stage->in, 0, 0};
+		bitstreamFlushRead(&inb);
+		src = &inb;
+	}
+	Sink *sink = sinkOpenFile(stage->out);
+	stage->algorithm->decode(src, sink);
+	sinkClose(sink);
+	if (stage->ring_in) fclose(stage->in);
+	fclose(stage->out);
+	return NULL;
+}
+
+static void writeLengths(Bitstream *out, Count const *lens, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		bitstreamWriteBits(out, 32, (uint64_t) lens[i] >> 32);
+		bitstreamWriteBits(out, 32, (uint64_t) lens[i] & 0xFFFFFFFF);
+	}
+}
+
+Count pipelineMemory(Chain const *chain)
+{
+	// each ring also has a stdio buffer on either end.
+	return (Count) (chain->count - 1) * (PIPE_RING_SIZE + 2 * PIPE_STREAM_BUFFER);
+}
+
+void encodeChainPipelined(Chain const *chain, FILE *in, Bitstream *out)
+{
+	int const last = chain->count - 1;
+	if (last == 0) {
+		encodeChain(chain, in, out);
+		return;
+	}
+
+	Count lens[CHAIN_MAX_STAGES];
+	long start = ftell(in);
+	fseek(in, 0, SEEK_END);
+	lens[0] = ftell(in) - start;
+	fseek(in, start, SEEK_SET);
+
+	// ring i carries the output of stage i - 1. The last stage's output has
+	// to wait in a temporary file until all the lengths are known.
+	Ring rings[CHAIN_MAX_STAGES];
+	PipeStage stages[CHAIN_MAX_STAGES];
+	FILE *tail = tmpfile();
+	for (int i = 0; i <= last; ++i)
+		stages[i] = (PipeStage) {chain->stages[i], &chain->params[i], in, tail, NULL, 0, 0, 0};
+	for (int i = 1; i <= last; ++i) {
+		initRing(&rings[i], INT64_MAX);
+		stages[i].in = openRing(&rings[i], "r");
+		stages[i].ring_in = 1;
+		stages[i - 1].out = openRing(&rings[i], "w");
+		stages[i - 1].ring_out = 1;
+	}
+
+	for (int i = 0; i < last; ++i)
+		pthread_create(&stages[i].thread, NULL, encodeStage, &stages[i]);
+	encodeStage(&stages[last]);
+	for (int i = 0; i < last; ++i)
+		pthread_join(stages[i].thread, NULL);
+	for (int i = 1; i <= last; ++i) {
+		lens[i] = rings[i].written;
+		free(rings[i].data);
+	}
+
+	writeLengths(out, lens, last + 1);
+	rewind(tail);
+	bitstreamCopyWords(out, tail);
+	fclose(tail);
+}
+
+void decodeChainPipelined(Chain const *chain, Bitstream *in, Sink *out)
+{
+	int const last = chain->count - 1;
+	if (last == 0) {
+		decodeChain(chain, in, out);
+		return;
+	}
+
+	Count lens[CHAIN_MAX_STAGES];
+	for (int i = 0; i <= last; ++i) {
+		uint64_t hi = bitstreamReadBits(in, 32);
+		uint64_t lo = bitstreamReadBits(in, 32);
+		lens[i] = (hi << 32) | lo;
+	}
+	if (feof(in->file)) return;
+
+	// ring i carries the output of stage i, cut off where the padding starts.
+	Ring rings[CHAIN_MAX_STAGES];
+	PipeStage stages[CHAIN_MAX_STAGES];
+	for (int i = 0; i <= last; ++i) {
+		initRing(&rings[i], lens[i]);
+		stages[i] = (PipeStage) {chain->stages[i], &chain->params[i], NULL, openRing(&rings[i], "w"), NULL, 0, 1, 0};
+	}
+	for (int i = 0; i < last; ++i) {
+		stages[i].in = openRing(&rings[i + 1], "r");
+		stages[i].ring_in = 1;
+	}
+	stages[last].inb = in;
+
+	for (int i = 0; i <= last; ++i)
+		pthread_create(&stages[i].thread, NULL, decodeStage, &stages[i]);
+
+	FILE *result = openRing(&rings[0], "r");
+	char buf[KB(64)];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), result)) > 0)
+		sinkWrite(out, buf, len);
+	fclose(result);
+
+	for (int i = 0; i <= last; ++i)
+		pthread_join(stages[i].thread, NULL);
+	for (int i = 0; i <= last; ++i)
+		free(rings[i].data);
+}
@@ -0,0 +1,48 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+// depends on stdio.h
+// depends on stdint.h
+// depends on bitstream.h
+// depends on sink.h
+// depends on base.h
+// depends on chain.h
+
+#ifdef CMPLAB_PIPELINE_H
+#error multiple inclusion
+#endif
+#define CMPLAB_PIPELINE_H
+
+#define PIPE_RING_SIZE (1 << 20)
+
+/* Same streams as encodeChain and decodeChain, but every stage runs on its
+ * own thread, handing its output to the next stage through a lock-free
+ * single-producer, single-consumer ring, so a chain runs about as fast as its
+ * slowest stage. Encoders without ALGORITHM_STREAMS get their input spooled
+ * to a temporary file first, since they want to seek around in it. */
+void encodeChainPipelined(Chain const *chain, FILE *in, Bitstream *out);
+void decodeChainPipelined(Chain const *chain, Bitstream *in, Sink *out);
+
+/* Memory taken up by the rings between the stages, on top of what the stages
+ * themselves use. */
+Count pipelineMemory(Chain const *chain);
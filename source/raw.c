@@ -0,0 +1,62 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+
+/* Stores the input as-is. This is what incompressible data should get. */
+
+void encode_raw(FILE *in, Bitstream *out, Params const *params)
+{
+	(void) params;
+	for (;;) {
+		Symbol sym = fgetc(in);
+		if (feof(in)) return;
+		bitstreamWriteBits(out, 8, sym);
+	}
+}
+
+Count size_raw(FILE *in, Params const *params, int *exact)
+{
+	(void) params;
+	char buf[KB(64)];
+	Count bits = 0;
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), in)) > 0)
+		bits += 8 * len;
+	*exact = 1;
+	return bits;
+}
+
+void decode_raw(Bitstream *in, Sink *out)
+{
+	for (;;) {
+		Symbol sym = bitstreamReadBits(in, 8);
+		if (feof(in->file)) return;
+		sinkPutc(out, sym);
+	}
+}
@@ -0,0 +1,156 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+
+/* Run-length coding for runs of any byte value.
+ * The stream alternates between literal stretches and run codes:
+ *   gamma(nlit + 1), nlit literal bytes
+ *   gamma(code): 1 = end of stream, 2 = no run here, otherwise a run of
+ *                code - 3 + RLE_MIN_RUN copies of the 8-bit symbol that follows.
+ * Runs are found a word at a time, and a run may continue across input blocks. */
+
+#define RLE_BLOCK KB(64)
+#define RLE_MIN_RUN 3
+
+#define RLE_END 1
+#define RLE_NORUN 2
+#define RLE_RUN 3
+
+/* number of leading bytes of p that are equal to sym. */
+static size_t scanrun(unsigned char const *p, size_t len, unsigned char sym)
+{
+	uint64_t const pattern = UINT64_C(0x0101010101010101) * sym;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t word;
+		memcpy(&word, p + i, sizeof(word));
+		uint64_t diff = word ^ pattern;
+		if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return i + (__builtin_ctzll(diff) >> 3);
+#else
+			return i + (__builtin_clzll(diff) >> 3);
+#endif
+		}
+	}
+	while (i < len && p[i] == sym) ++i;
+	return i;
+}
+
+static void emitliterals(Bitstream *out, unsigned char const *p, size_t len)
+{
+	bitstreamWriteGamma(out, len + 1);
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		unsigned long word = p[i] | (p[i + 1] << 8) | (p[i + 2] << 16) | ((unsigned long) p[i + 3] << 24);
+		bitstreamWriteBits(out, 32, word);
+	}
+	for (; i < len; ++i)
+		bitstreamWriteBits(out, 8, p[i]);
+}
+
+static void emitrun(Bitstream *out, unsigned char sym, Count len)
+{
+	bitstreamWriteGamma(out, len - RLE_MIN_RUN + RLE_RUN);
+	bitstreamWriteBits(out, 8, sym);
+}
+
+void encode_rle(FILE *in, Bitstream *out, Params const *params)
+{
+	(void) params;
+	unsigned char *buf = malloc(RLE_BLOCK);
+	unsigned char run_sym = 0;
+	Count run_len = 0; // a run that reached the end of the previous block
+	size_t len;
+	while ((len = fread(buf, 1, RLE_BLOCK, in)) > 0) {
+		size_t i = 0;
+		if (run_len > 0) {
+			i = scanrun(buf, len, run_sym);
+			run_len += i;
+			if (i == len) continue;
+			emitrun(out, run_sym, run_len);
+			run_len = 0;
+		}
+
+		size_t lit_start = i;
+		while (i < len) {
+			size_t n = scanrun(buf + i, len - i, buf[i]);
+			if (n < RLE_MIN_RUN) {
+				i += n;
+				continue;
+			}
+			emitliterals(out, buf + lit_start, i - lit_start);
+			if (i + n == len) {
+				run_sym = buf[i];
+				run_len = n;
+			} else {
+				emitrun(out, buf[i], n);
+			}
+			i += n;
+			lit_start = i;
+		}
+		if (run_len == 0 && lit_start < len) {
+			emitliterals(out, buf + lit_start, len - lit_start);
+			bitstreamWriteGamma(out, RLE_NORUN);
+		}
+	}
+	if (run_len > 0)
+		emitrun(out, run_sym, run_len);
+	bitstreamWriteGamma(out, 1); // empty literal stretch
+	bitstreamWriteGamma(out, RLE_END);
+	free(buf);
+}
+
+void decode_rle(Bitstream *in, Sink *out)
+{
+	for (;;) {
+		uint64_t nlit = bitstreamReadGamma(in);
+		if (nlit == 0) break;
+		--nlit;
+		for (; nlit >= 4; nlit -= 4) {
+			unsigned long word = bitstreamReadBits(in, 32);
+			sinkPutc(out, word & 0xFF);
+			sinkPutc(out, (word >> 8) & 0xFF);
+			sinkPutc(out, (word >> 16) & 0xFF);
+			sinkPutc(out, (word >> 24) & 0xFF);
+		}
+		for (; nlit > 0; --nlit)
+			sinkPutc(out, bitstreamReadBits(in, 8));
+		if (feof(in->file)) break;
+
+		uint64_t code = bitstreamReadGamma(in);
+		if (code <= RLE_END) break;
+		if (code == RLE_NORUN) continue;
+		unsigned char sym = bitstreamReadBits(in, 8);
+		if (feof(in->file)) break;
+		sinkFill(out, sym, code - RLE_RUN + RLE_MIN_RUN);
+	}
+}
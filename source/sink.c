@@ -0,0 +1,208 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for vmsplice, F_SETPIPE_SZ and fallocate
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "sink.h"
+
+/* vmsplice puts references to our pages into the pipe instead of copying
+ * them, and whoever reads the pipe may in turn splice or tee them on, so
+ * there is no telling when the last reference goes away. A spliced buffer
+ * is therefore gifted to the pipe and never written again: the sink unmaps
+ * it (the pipe keeps the pages alive) and carries on in a fresh mapping. */
+
+static unsigned char *allocBuffer(size_t size)
+{
+	// mapped rather than malloc'ed, so the pages are whole and never shared with other allocations.
+	void *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return buf == MAP_FAILED ? NULL : buf;
+}
+
+static Sink *newSink(int fd, FILE *file, int pipe, size_t cap)
+{
+	Sink *sink = calloc(1, sizeof(*sink));
+	sink->fd = fd;
+	sink->file = file;
+	sink->pipe = pipe;
+	sink->cap = cap;
+	sink->limit = SINK_UNLIMITED;
+	sink->buf = allocBuffer(cap);
+	if (sink->buf == NULL) {
+		fprintf(stderr, "cannot allocate output buffers.\n");
+		exit(EXIT_FAILURE);
+	}
+	return sink;
+}
+
+Sink *sinkOpenFd(int fd)
+{
+	struct stat st;
+	int known = fstat(fd, &st) == 0;
+	if (known && S_ISFIFO(st.st_mode)) {
+		int size = fcntl(fd, F_SETPIPE_SZ, SINK_BUFFER_SIZE);
+		if (size < 0) size = fcntl(fd, F_GETPIPE_SZ);
+		if (size > 0) return newSink(fd, NULL, 1, size);
+	}
+	Sink *sink = newSink(fd, NULL, 0, SINK_BUFFER_SIZE);
+	// appending writes would land on top of the skipped bytes.
+	sink->sparse = known && S_ISREG(st.st_mode) && !(fcntl(fd, F_GETFL) & O_APPEND);
+	return sink;
+}
+
+Sink *sinkOpenFile(FILE *file)
+{
+	return newSink(-1, file, 0, SINK_FILE_BUFFER_SIZE);
+}
+
+static void spliceOut(Sink *sink)
+{
+	struct iovec iov = {sink->buf, sink->len};
+	while (iov.iov_len > 0) {
+		ssize_t n = vmsplice(sink->fd, &iov, 1, SPLICE_F_GIFT);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			sink->error = 1;
+			return;
+		}
+		iov.iov_base = (char *) iov.iov_base + n;
+		iov.iov_len -= n;
+	}
+	munmap(sink->buf, sink->cap);
+	sink->buf = allocBuffer(sink->cap);
+	if (sink->buf == NULL) {
+		fprintf(stderr, "cannot allocate output buffers.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void writeOut(Sink *sink)
+{
+	unsigned char const *p = sink->buf;
+	size_t left = sink->len;
+	while (left > 0) {
+		ssize_t n = write(sink->fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			sink->error = 1;
+			return;
+		}
+		p += n;
+		left -= n;
+	}
+	sink->skipped = 0;
+}
+
+void sinkFlush(Sink *sink)
+{
+	if (sink->len > sink->limit) sink->len = sink->limit;
+	sink->limit -= sink->len;
+	if (sink->len == 0) return;
+	if (!sink->error) {
+		if (sink->file != NULL) {
+			if (fwrite(sink->buf, 1, sink->len, sink->file) != sink->len) sink->error = 1;
+		} else if (sink->pipe) {
+			spliceOut(sink);
+		} else {
+			writeOut(sink);
+		}
+	}
+	sink->len = 0;
+}
+
+void sinkLimit(Sink *sink, uint64_t len)
+{
+	sinkFlush(sink);
+	sink->limit = len;
+}
+
+void sinkWrite(Sink *sink, void const *data, size_t len)
+{
+	unsigned char const *p = data;
+	while (len > 0) {
+		if (sink->len == sink->cap) sinkFlush(sink);
+		size_t n = sink->cap - sink->len < len ? sink->cap - sink->len : len;
+		memcpy(sink->buf + sink->len, p, n);
+		sink->len += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/* Moves past len bytes that have to read as zeros, punching out whatever the
+ * file held there before. Returns -1 if they have to be written after all. */
+static int skipZeros(Sink *sink, uint64_t len)
+{
+	sinkFlush(sink);
+	struct stat st;
+	off_t at = lseek(sink->fd, 0, SEEK_CUR);
+	if (at < 0 || fstat(sink->fd, &st) != 0) return -1;
+	if (at < st.st_size && fallocate(sink->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, at, len) != 0)
+		return -1;
+	if (lseek(sink->fd, len, SEEK_CUR) < 0) return -1;
+	sink->limit -= len;
+	sink->skipped = 1;
+	return 0;
+}
+
+void sinkFill(Sink *sink, int c, uint64_t len)
+{
+	// nothing past the limit gets through, so don't bother making it.
+	uint64_t const room = sink->limit > sink->len ? sink->limit - sink->len : 0;
+	if (len > room) len = room;
+	if (c == 0 && sink->sparse && len >= SINK_HOLE_MIN && !sink->error && skipZeros(sink, len) == 0)
+		return;
+	while (len > 0) {
+		if (sink->len == sink->cap) sinkFlush(sink);
+		size_t n = sink->cap - sink->len < len ? sink->cap - sink->len : len;
+		memset(sink->buf + sink->len, c, n);
+		sink->len += n;
+		len -= n;
+	}
+}
+
+int sinkClose(Sink *sink)
+{
+	sinkFlush(sink);
+	if (sink->skipped) {
+		// seeking past the end doesn't make the file any longer.
+		struct stat st;
+		off_t end = lseek(sink->fd, 0, SEEK_CUR);
+		if (end < 0 || fstat(sink->fd, &st) != 0 || (st.st_size < end && ftruncate(sink->fd, end) != 0))
+			sink->error = 1;
+	}
+	if (sink->file != NULL && fflush(sink->file) != 0) sink->error = 1;
+	int status = sink->error ? -1 : 0;
+	munmap(sink->buf, sink->cap);
+	free(sink);
+	return status;
+}
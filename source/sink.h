@@ -0,0 +1,72 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+// depends on stdio.h
+// depends on stdint.h
+
+#ifdef CMPLAB_SINK_H
+#error multiple inclusion
+#endif
+#define CMPLAB_SINK_H
+
+#define SINK_BUFFER_SIZE (1 << 20) // for file descriptors; pipes may end up smaller
+#define SINK_FILE_BUFFER_SIZE (1 << 16)
+#define SINK_HOLE_MIN (1 << 16) // zero runs at least this long become holes in regular files
+
+/* Where decoders put their output. Bytes are collected in large page-aligned
+ * buffers and handed on a whole buffer at a time: gifted to the pipe with
+ * vmsplice if the target is one, with plain write calls for other file
+ * descriptors, and with fwrite for streams. Long runs of zeros are skipped
+ * over in regular files, leaving holes behind. */
+typedef struct {
+	unsigned char *buf; // the buffer being filled
+	size_t len, cap;
+	int fd; // -1 if backed by file
+	FILE *file;
+	int pipe;
+	int sparse; // fd is a regular file that can have holes
+	int skipped; // the last bytes were skipped, so the file may still need extending
+	int error;
+	uint64_t limit; // bytes still let through on flushing, the rest is dropped
+} Sink;
+
+#define SINK_UNLIMITED UINT64_MAX
+
+Sink *sinkOpenFd(int fd);
+Sink *sinkOpenFile(FILE *file);
+/* Flushes everything and frees the sink, but leaves the fd or stream open.
+ * Returns -1 if any write failed. */
+int sinkClose(Sink *sink);
+
+void sinkFlush(Sink *sink);
+/* Flushes what is buffered, then lets only len more bytes through and
+ * quietly drops the rest. This is how decoders get their padding cut off. */
+void sinkLimit(Sink *sink, uint64_t len);
+void sinkWrite(Sink *sink, void const *data, size_t len);
+void sinkFill(Sink *sink, int c, uint64_t len);
+
+static inline void sinkPutc(Sink *sink, int c)
+{
+	if (sink->len == sink->cap) sinkFlush(sink);
+	sink->buf[sink->len++] = c;
+}
@@ -21,51 +21,192 @@
  * SOFTWARE.
  ****/
 
+#define _GNU_SOURCE // for SEEK_DATA and SEEK_HOLE
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "bitstream.h"
+#include "sink.h"
 #include "base.h"
 
-void encode_zle(FILE *in, Bitstream *out)
+/* Zero-length encoding: symbols are stored as-is, but every zero symbol is
+ * followed by the gamma-coded number of further zeros after it, plus one.
+ * Symbols are bytes or, with "zle:16", little-endian 16-bit words (an odd
+ * trailing byte is zero-extended); a header bit tells which. */
+
+#define ZLE_BUFFER_SIZE KB(64)
+
+static int symbolwidth(Params const *params)
+{
+	if (params->arg == NULL || strcmp(params->arg, "8") == 0) return 8;
+	if (strcmp(params->arg, "16") == 0) return 16;
+	fprintf(stderr, "incorrect zle parameters.\n");
+	exit(EXIT_FAILURE);
+}
+
+/* The encoder works on whole buffers, and takes holes in sparse files as
+ * zeros it never has to read. Sizing runs the same code without a bitstream. */
+typedef struct {
+	Bitstream *out; // NULL to only count
+	int width;
+	Count bits;
+	Count run; // zero symbols not written yet
+	int half; // 16 bits: whether low holds the first byte of a symbol
+	Symbol low;
+} ZleScan;
+
+/* Inlined with a constant width into the loops of scanbytes. */
+static inline void flushrun(ZleScan *z, int width)
 {
-	int bitsize = 1;
-	while ((ALPHABET_SIZE - 1) >> bitsize > 0) ++bitsize;
-
-	Symbol sym;
-	for (;;) {
-		do {
-			sym = fgetc(in);
-			if (feof(in)) return;
-			bitstreamWriteBits(out, bitsize, sym);
-		} while (sym != 0);
-
-		unsigned int run = 0;
-		do {
-			sym = fgetc(in);
-			++run; // also counts the first non-zero, but that's okay because we start run from 0 instead of 1.
-		} while (sym == 0);
-		bitstreamWriteBits(out, 16, run - 1); // we know that run is always at least 1, so we start subtract that.
+	if (z->run == 0) return;
+	if (z->out != NULL) {
+		bitstreamWriteBits(z->out, width, 0);
+		bitstreamWriteGamma(z->out, z->run);
+	}
+	z->bits += width + bitstreamGammaLength(z->run);
+	z->run = 0;
+}
+
+static inline void putsym(ZleScan *z, int width, Symbol sym)
+{
+	if (sym == 0) {
+		++z->run;
+		return;
+	}
+	flushrun(z, width);
+	if (z->out != NULL) bitstreamWriteBits(z->out, width, sym);
+	z->bits += width;
+}
+
+static void scanbytes(ZleScan *z, unsigned char const *buf, size_t len)
+{
+	size_t i = 0;
+	if (z->width == 8) {
+		for (; i < len; ++i) putsym(z, 8, buf[i]);
+		return;
+	}
+	if (z->half && len > 0) {
+		putsym(z, 16, z->low | buf[i++] << 8);
+		z->half = 0;
+	}
+	for (; i + 1 < len; i += 2) putsym(z, 16, buf[i] | buf[i + 1] << 8);
+	if (i < len) {
+		z->low = buf[i];
+		z->half = 1;
+	}
+}
+
+static void scanzeros(ZleScan *z, Count len)
+{
+	if (len > 0 && z->half) {
+		putsym(z, z->width, z->low);
+		z->half = 0;
+		--len;
+	}
+	z->run += len / (z->width / 8);
+	if (z->width == 16 && len % 2 == 1) {
+		z->low = 0;
+		z->half = 1;
 	}
 }
 
-void decode_zle(Bitstream *in, FILE *out)
+static void scanend(ZleScan *z)
 {
-	int bitsize = 1;
-	while ((ALPHABET_SIZE - 1) >> bitsize > 0) ++bitsize;
-
-	for (;;) {
-		for (;;) {
-			Symbol sym = bitstreamReadBits(in, bitsize);
-			if (feof(in->file)) return;
-			fputc(sym, out);
-			if (sym == 0) break;
+	// an odd byte at the end is zero-extended.
+	if (z->half) putsym(z, z->width, z->low);
+	flushrun(z, z->width);
+}
+
+/* Regular files are read a data extent at a time with the holes in between
+ * taken as zeros, so sparse files cost time in proportion to their data. */
+static int scansparse(ZleScan *z, FILE *in, unsigned char *buf, size_t size)
+{
+	struct stat st;
+	int fd = fileno(in);
+	off_t pos = ftello(in);
+	if (fd < 0 || pos < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+	off_t const end = st.st_size;
+	while (pos < end) {
+		off_t data = lseek(fd, pos, SEEK_DATA);
+		off_t hole = data >= 0 ? lseek(fd, data, SEEK_HOLE) : -1;
+		if (data < 0 && errno == ENXIO) {
+			data = hole = end; // only a hole left
+		} else if (data < 0 || hole < 0) {
+			data = pos; // no hole support, it's all data
+			hole = end;
 		}
+		if (hole > end) hole = end;
+		scanzeros(z, data - pos);
+		for (pos = data; pos < hole; ) {
+			ssize_t n = pread(fd, buf, hole - pos < (off_t) size ? (size_t) (hole - pos) : size, pos);
+			if (n <= 0) return 0; // truncated under our feet, stop here like a short read would
+			scanbytes(z, buf, n);
+			pos += n;
+		}
+	}
+	fseeko(in, end, SEEK_SET);
+	return 0;
+}
+
+static void scan(ZleScan *z, FILE *in)
+{
+	unsigned char *buf = malloc(ZLE_BUFFER_SIZE);
+	if (scansparse(z, in, buf, ZLE_BUFFER_SIZE) != 0) {
+		size_t len;
+		while ((len = fread(buf, 1, ZLE_BUFFER_SIZE, in)) > 0)
+			scanbytes(z, buf, len);
+	}
+	scanend(z);
+	free(buf);
+}
 
-		unsigned int run = bitstreamReadBits(in, 16) + 1; // we know that run is always at least 1, so we start subtract that.
-		do {
-			fputc(0, out);
-			--run;
-		} while (run > 0); // works because we already output the first zero in the previous loop.
+void encode_zle(FILE *in, Bitstream *out, Params const *params)
+{
+	int const width = symbolwidth(params);
+	bitstreamWriteBits(out, 1, width == 16);
+	ZleScan z = {out, width, 1, 0, 0, 0};
+	scan(&z, in);
+}
+
+Count size_zle(FILE *in, Params const *params, int *exact)
+{
+	ZleScan z = {NULL, symbolwidth(params), 1, 0, 0, 0};
+	scan(&z, in);
+	*exact = 1;
+	return z.bits;
+}
+
+/* One loop per width, so that the bitstream gets a constant one and only
+ * has to check for the end of the input when a symbol crosses into the next word. */
+#define ZLE_DECODE_KERNEL(NAME, W) \
+	static void NAME(Bitstream *in, Sink *out) \
+	{ \
+		for (;;) { \
+			int const spill = 32 - in->buf_cur < (W); \
+			Symbol sym = bitstreamReadBits(in, W); \
+			if (spill && feof(in->file)) return; \
+			sinkPutc(out, sym & 0xFF); \
+			if ((W) == 16) sinkPutc(out, sym >> 8); \
+			if (sym != 0) continue; \
+			uint64_t run = bitstreamReadGamma(in); \
+			if (run == 0) return; \
+			sinkFill(out, 0, (run - 1) * ((W) / 8)); \
+		} \
+	}
+
+ZLE_DECODE_KERNEL(decode8, 8)
+ZLE_DECODE_KERNEL(decode16, 16)
+
+void decode_zle(Bitstream *in, Sink *out)
+{
+	if (bitstreamReadBits(in, 1)) {
+		decode16(in, out);
+	} else {
+		decode8(in, out);
 	}
 }
@@ -0,0 +1,133 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "asyncio.h"
+
+#define ASYNC_DATA_SIZE (ASYNC_BUFFER_SIZE * 3 + ASYNC_BUFFER_SIZE / 2 + 7)
+
+static unsigned char *makeData(void)
+{
+	unsigned char *data = malloc(ASYNC_DATA_SIZE);
+	for (int i = 0; i < ASYNC_DATA_SIZE; ++i)
+		data[i] = rand();
+	return data;
+}
+
+/* reads length bytes at the reader's current position and compares them. */
+static void readAt(FILE *reader, unsigned char const *data, long offset, long length)
+{
+	sd_push("offset = %ld, length = %ld", offset, length);
+	sd_assertiq(offset, ftell(reader));
+	unsigned char *back = malloc(length + 1);
+	sd_assertiq(length, fread(back, 1, length, reader));
+	sd_assert(memcmp(back, data + offset, length) == 0);
+	sd_assertiq(offset + length, ftell(reader));
+	free(back);
+	sd_pop();
+}
+
+static void prefetch(void)
+{
+	sd_push("prefetch");
+	unsigned char *data = makeData();
+	FILE *src = tmpfile();
+	fwrite(data, 1, ASYNC_DATA_SIZE, src);
+	rewind(src);
+
+	FILE *reader = openPrefetchReader(src);
+	readAt(reader, data, 0, 1000);
+	readAt(reader, data, 1000, ASYNC_BUFFER_SIZE * 2); // across a buffer the thread has to refill
+
+	// back, forward past what was prefetched, and back again relative to here.
+	sd_assertiq(0, fseek(reader, 12345, SEEK_SET));
+	readAt(reader, data, 12345, ASYNC_BUFFER_SIZE);
+	sd_assertiq(0, fseek(reader, ASYNC_BUFFER_SIZE * 3 + 11, SEEK_SET));
+	readAt(reader, data, ASYNC_BUFFER_SIZE * 3 + 11, 5000);
+	sd_assertiq(0, fseek(reader, -(long) ASYNC_BUFFER_SIZE * 2, SEEK_CUR));
+	readAt(reader, data, ASYNC_BUFFER_SIZE + 5011, ASYNC_BUFFER_SIZE);
+
+	// the tail, and nothing after it.
+	sd_assertiq(0, fseek(reader, -100, SEEK_END));
+	readAt(reader, data, ASYNC_DATA_SIZE - 100, 100);
+	sd_assertiq(EOF, fgetc(reader));
+	sd_assertiq(0, fseek(reader, 0, SEEK_SET));
+	readAt(reader, data, 0, ASYNC_DATA_SIZE);
+	sd_assertiq(EOF, fgetc(reader));
+	fclose(reader);
+
+	// a stream that was already read into starts where it was.
+	sd_assertiq(0, fseek(src, 777, SEEK_SET));
+	reader = openPrefetchReader(src);
+	readAt(reader, data, 777, ASYNC_DATA_SIZE - 777);
+	fclose(reader);
+
+	fclose(src);
+	free(data);
+	sd_pop();
+}
+
+static void writeBehind(void)
+{
+	sd_push("write-behind");
+	unsigned char *data = makeData();
+	FILE *dst = tmpfile();
+	FILE *writer = openWriteBehind(dst);
+	// odd chunk sizes, so the buffer swaps land in the middle of writes.
+	size_t const chunks[] = {1, 999, ASYNC_BUFFER_SIZE - 1000, 3, ASYNC_BUFFER_SIZE * 2 + 17, 4096};
+	size_t done = 0;
+	for (int c = 0; done < ASYNC_DATA_SIZE; c = (c + 1) % 6) {
+		size_t n = chunks[c] < ASYNC_DATA_SIZE - done ? chunks[c] : ASYNC_DATA_SIZE - done;
+		sd_assertiq(n, fwrite(data + done, 1, n, writer));
+		done += n;
+	}
+	sd_assertiq(0, fclose(writer));
+
+	// the wrapped stream stays open, with everything in it.
+	sd_assertiq(ASYNC_DATA_SIZE, ftell(dst));
+	rewind(dst);
+	unsigned char *back = malloc(ASYNC_DATA_SIZE + 1);
+	sd_assertiq(ASYNC_DATA_SIZE, fread(back, 1, ASYNC_DATA_SIZE + 1, dst));
+	sd_assert(memcmp(back, data, ASYNC_DATA_SIZE) == 0);
+	free(back);
+	fclose(dst);
+	free(data);
+	sd_pop();
+}
+
+void asyncioTest(void)
+{
+	sd_push("asyncio");
+	prefetch();
+	writeBehind();
+	sd_pop();
+}
@@ -0,0 +1,133 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+
+extern void encode_auto(FILE *in, Bitstream *out, Params const *params);
+extern void decode_auto(Bitstream *in, Sink *out);
+
+static Algorithm const autoAlgorithm = {"auto", encode_auto, decode_auto, 0, NULL};
+
+// the index auto.c stores in front of the chosen codec's stream.
+#define CHOSE_RAW 0
+#define CHOSE_ZLE 1
+#define CHOSE_HUFF 2
+#define CHOSE_LZW 3
+
+#define AUTO_DATA_SIZE (KB(300) + 1)
+
+enum { NOISE, ZEROS, TEXT };
+
+static unsigned char *makeData(int kind)
+{
+	static char const *words[] = {"alpha ", "beta ", "gamma ", "delta ", "epsilon ", "zeta ", "eta ", "theta "};
+	unsigned char *data = malloc(AUTO_DATA_SIZE);
+	for (int i = 0; i < AUTO_DATA_SIZE; ) {
+		if (kind == NOISE) {
+			data[i++] = rand();
+		} else if (kind == ZEROS) {
+			// long zero runs with the odd byte in between.
+			data[i++] = rand() % 500 == 0 ? rand() : 0;
+		} else {
+			char const *word = words[rand() % 8];
+			for (int j = 0; word[j] != '\0' && i < AUTO_DATA_SIZE; ++j)
+				data[i++] = word[j];
+		}
+	}
+	return data;
+}
+
+/* round-trips the data and returns the codec auto picked for it. */
+static int roundtrip(int kind, int level)
+{
+	unsigned char *data = makeData(kind);
+	FILE *raw = tmpfile();
+	fwrite(data, 1, AUTO_DATA_SIZE, raw);
+	rewind(raw);
+
+	Chain chain = {{&autoAlgorithm}, {{NULL, 0, level}}, 1};
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	encodeChain(&chain, raw, &w);
+	bitstreamFlushWrite(&w);
+
+	// the choice comes right after the chain's 64-bit length.
+	rewind(enc);
+	Bitstream peek = {enc, 0, 0};
+	bitstreamFlushRead(&peek);
+	bitstreamReadBits(&peek, 32);
+	bitstreamReadBits(&peek, 32);
+	int choice = bitstreamReadBits(&peek, 8);
+
+	rewind(enc);
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decodeChain(&chain, &r, sink);
+	sinkClose(sink);
+	sd_assertiq(AUTO_DATA_SIZE, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(AUTO_DATA_SIZE);
+	sd_assertiq(AUTO_DATA_SIZE, fread(back, 1, AUTO_DATA_SIZE, dec));
+	sd_assert(memcmp(back, data, AUTO_DATA_SIZE) == 0);
+
+	free(back);
+	free(data);
+	fclose(dec);
+	fclose(enc);
+	fclose(raw);
+	return choice;
+}
+
+static void choices(int level)
+{
+	sd_push("level %d", level);
+	sd_assertiq(CHOSE_RAW, roundtrip(NOISE, level));
+	sd_assertiq(CHOSE_ZLE, roundtrip(ZEROS, level));
+	int const text = roundtrip(TEXT, level);
+	sd_push("text: %d", text);
+	// the fastest levels leave lzw out.
+	sd_assert(text == CHOSE_HUFF || (text == CHOSE_LZW && level > 2));
+	sd_pop();
+	sd_pop();
+}
+
+void autoTest(void)
+{
+	sd_push("auto");
+	choices(LEVEL_MIN);
+	choices(LEVEL_DEFAULT);
+	choices(LEVEL_MAX);
+	sd_pop();
+}
@@ -0,0 +1,191 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for nftw's FTW_PHYS
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+#include "pack.h"
+#include "batch.h"
+
+extern void encode_lzw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_lzw(Bitstream *in, Sink *out);
+
+static Algorithm const lzwAlgorithm = {"lzw", encode_lzw, decode_lzw, ALGORITHM_STREAMS, NULL};
+static Chain const lzw = {{&lzwAlgorithm}, {{NULL, 0, 0}}, 1};
+
+#define BATCH_BLOCK_SIZE PACK_MIN_BLOCK_SIZE
+
+static char *join(char const *dir, char const *name)
+{
+	char *path = malloc(strlen(dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+static unsigned char *makeFile(char const *dir, char const *name, size_t size)
+{
+	unsigned char *data = malloc(size + 1);
+	for (size_t i = 0; i < size; ++i)
+		data[i] = "abcabdabe"[rand() % 9];
+	char *path = join(dir, name);
+	FILE *file = fopen(path, "wb");
+	sd_assert(file != NULL);
+	sd_assertiq(size, fwrite(data, 1, size, file));
+	fclose(file);
+	free(path);
+	return data;
+}
+
+static int exists(char const *dir, char const *name)
+{
+	char *path = join(dir, name);
+	int found = access(path, F_OK) == 0;
+	free(path);
+	return found;
+}
+
+// name is the original file; its pack has to give back data.
+static void checkPacked(char const *dir, char const *name, unsigned char const *data, size_t size)
+{
+	sd_push("file = %s", name);
+	char *path = malloc(strlen(dir) + strlen(name) + 6);
+	sprintf(path, "%s/%s.cmp", dir, name);
+	FILE *packed = fopen(path, "rb");
+	sd_assert(packed != NULL);
+	FILE *out = tmpfile();
+	Sink *sink = sinkOpenFile(out);
+	sd_assertiq(0, unpackStream(&lzw, packed, sink));
+	sd_assertiq(0, sinkClose(sink));
+	sd_assertiq(size, ftell(out));
+	rewind(out);
+	unsigned char *back = malloc(size + 1);
+	sd_assertiq(size, fread(back, 1, size, out));
+	sd_assert(memcmp(back, data, size) == 0);
+	free(back);
+	fclose(out);
+	fclose(packed);
+	free(path);
+	sd_pop();
+}
+
+static int removeEntry(char const *path, struct stat const *st, int flag, struct FTW *ftw)
+{
+	(void) st, (void) flag, (void) ftw;
+	return remove(path);
+}
+
+static void tree(void)
+{
+	sd_push("tree");
+	char dir[] = "/tmp/cmplab-batch-XXXXXX";
+	sd_assert(mkdtemp(dir) != NULL);
+	char *sub = join(dir, "sub");
+	sd_assertiq(0, mkdir(sub, 0700));
+
+	size_t const asize = BATCH_BLOCK_SIZE * 3 + 123, bsize = BATCH_BLOCK_SIZE * 64;
+	unsigned char *a = makeFile(dir, "a", asize);
+	unsigned char *empty = makeFile(dir, "empty", 0);
+	unsigned char *b = makeFile(sub, "b", bsize);
+	unsigned char *old = makeFile(sub, "old.cmp", 100);
+	// a link back up the tree must not be walked.
+	char *loop = join(sub, "loop");
+	sd_assertiq(0, symlink("..", loop));
+
+	char *paths[] = {dir};
+	sd_assertiq(0, batchPack(&lzw, paths, 1, BATCH_BLOCK_SIZE, PACK_CHECKSUM, 8));
+	checkPacked(dir, "a", a, asize);
+	checkPacked(dir, "empty", empty, 0);
+	checkPacked(sub, "b", b, bsize);
+	sd_assert(!exists(sub, "old.cmp.cmp"));
+	sd_assert(!exists(sub, "loop.cmp"));
+
+	// packing the tree again leaves the first round's output alone.
+	sd_assertiq(0, batchPack(&lzw, paths, 1, BATCH_BLOCK_SIZE, 0, 3));
+	sd_assert(!exists(dir, "a.cmp.cmp"));
+	sd_assert(!exists(sub, "b.cmp.cmp"));
+	checkPacked(sub, "b", b, bsize);
+
+	nftw(dir, removeEntry, 8, FTW_DEPTH | FTW_PHYS);
+	free(loop);
+	free(sub);
+	free(a);
+	free(empty);
+	free(b);
+	free(old);
+	sd_pop();
+}
+
+static void files(void)
+{
+	sd_push("files");
+	char dir[] = "/tmp/cmplab-batch-XXXXXX";
+	sd_assert(mkdtemp(dir) != NULL);
+
+	size_t const sizes[] = {1, BATCH_BLOCK_SIZE, BATCH_BLOCK_SIZE * 5 - 1, BATCH_BLOCK_SIZE * 17};
+	char const *names[] = {"one", "block", "five", "seventeen.cmp"};
+	unsigned char *data[4];
+	char *paths[5];
+	for (int f = 0; f < 4; ++f) {
+		data[f] = makeFile(dir, names[f], sizes[f]);
+		paths[f] = join(dir, names[f]);
+	}
+	// a file named twice is packed once; a .cmp that is named explicitly is packed too.
+	paths[4] = join(dir, "five");
+	sd_assertiq(0, batchPack(&lzw, paths, 5, BATCH_BLOCK_SIZE, PACK_CHECKSUM, 4));
+	for (int f = 0; f < 4; ++f)
+		checkPacked(dir, names[f], data[f], sizes[f]);
+
+	// a missing file fails on its own, the others still get packed.
+	free(paths[4]);
+	paths[4] = join(dir, "missing");
+	sd_assertiq(1, batchPack(&lzw, paths + 2, 3, BATCH_BLOCK_SIZE, 0, 2));
+	checkPacked(dir, names[2], data[2], sizes[2]);
+	sd_assert(!exists(dir, "missing.cmp"));
+
+	nftw(dir, removeEntry, 8, FTW_DEPTH | FTW_PHYS);
+	for (int f = 0; f < 5; ++f)
+		free(paths[f]);
+	for (int f = 0; f < 4; ++f)
+		free(data[f]);
+	sd_pop();
+}
+
+void batchTest(void)
+{
+	sd_push("batch");
+	tree();
+	files();
+	sd_pop();
+}
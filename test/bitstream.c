@@ -23,10 +23,12 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "sd_cuts.h"
 
 #include "bitstream.h"
+#include "sink.h"
 #include "base.h"
 
 static void emptyBitstream(void)
@@ -95,11 +97,36 @@ static void roundtrip(void)
 	sd_pop();
 }
 
+static void gammaCodes(void)
+{
+	sd_push("gamma");
+	FILE *file = tmpfile();
+	uint64_t values[] = {1, 2, 3, 4, 7, 8, 255, 65536, 65537, UINT64_C(1) << 32, UINT64_MAX};
+	Bitstream w = {file, 0, 0};
+	for (int i = 0; i < (int) STATIC_LENGTH(values); ++i) {
+		bitstreamWriteBits(&w, i % 7, 0);
+		bitstreamWriteGamma(&w, values[i]);
+	}
+	bitstreamFlushWrite(&w);
+	rewind(file);
+	Bitstream r = {file, 0, 0};
+	bitstreamFlushRead(&r);
+	for (int i = 0; i < (int) STATIC_LENGTH(values); ++i) {
+		sd_push("i = %d", i);
+		bitstreamReadBits(&r, i % 7);
+		sd_assert(bitstreamReadGamma(&r) == values[i]);
+		sd_pop();
+	}
+	fclose(file);
+	sd_pop();
+}
+
 void bitstreamTest(void)
 {
 	sd_push("bitstream");
 	emptyBitstream();
 	noOverread();
 	roundtrip();
+	gammaCodes();
 	sd_pop();
 }
@@ -0,0 +1,330 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+#include "pipeline.h"
+
+extern void encode_delta(FILE *in, Bitstream *out, Params const *params);
+extern void decode_delta(Bitstream *in, Sink *out);
+extern void encode_huff(FILE *in, Bitstream *out, Params const *params);
+extern void decode_huff(Bitstream *in, Sink *out);
+extern Count size_huff(FILE *in, Params const *params, int *exact);
+extern void encode_rle(FILE *in, Bitstream *out, Params const *params);
+extern void decode_rle(Bitstream *in, Sink *out);
+extern void encode_zle(FILE *in, Bitstream *out, Params const *params);
+extern void decode_zle(Bitstream *in, Sink *out);
+extern Count size_zle(FILE *in, Params const *params, int *exact);
+extern void encode_raw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_raw(Bitstream *in, Sink *out);
+extern Count size_raw(FILE *in, Params const *params, int *exact);
+extern void encode_auto(FILE *in, Bitstream *out, Params const *params);
+extern void decode_auto(Bitstream *in, Sink *out);
+extern Count size_auto(FILE *in, Params const *params, int *exact);
+extern void encode_lzw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_lzw(Bitstream *in, Sink *out);
+extern Count size_lzw(FILE *in, Params const *params, int *exact);
+extern void encode_dedup(FILE *in, Bitstream *out, Params const *params);
+extern void decode_dedup(Bitstream *in, Sink *out);
+
+static Algorithm const delta = {"delta", encode_delta, decode_delta, ALGORITHM_STREAMS, NULL};
+static Algorithm const huff = {"huff", encode_huff, decode_huff, 0, size_huff};
+static Algorithm const rle = {"rle", encode_rle, decode_rle, ALGORITHM_STREAMS, NULL};
+static Algorithm const zle = {"zle", encode_zle, decode_zle, ALGORITHM_STREAMS | ALGORITHM_SPARSE, size_zle};
+static Algorithm const raw = {"raw", encode_raw, decode_raw, ALGORITHM_STREAMS, size_raw};
+static Algorithm const autoAlgorithm = {"auto", encode_auto, decode_auto, 0, size_auto};
+static Algorithm const lzw = {"lzw", encode_lzw, decode_lzw, ALGORITHM_STREAMS, size_lzw};
+static Algorithm const dedup = {"dedup", encode_dedup, decode_dedup, ALGORITHM_STREAMS, NULL};
+
+#define CHAIN_DATA_SIZE (KB(200) + 3)
+
+static void roundtrip(char const *arg, char const *huff_arg, int pipelined)
+{
+	sd_push("delta:%s+huff:%s%s", arg, huff_arg != NULL ? huff_arg : "8", pipelined ? ", pipelined" : "");
+	unsigned char *data = malloc(CHAIN_DATA_SIZE);
+	int32_t v = 0;
+	for (int i = 0; i < CHAIN_DATA_SIZE; ++i) {
+		v += rand() % 5 - 2;
+		data[i] = i % 4 == 0 ? v : i % 4 == 1 ? v >> 8 : rand() % 3;
+	}
+	FILE *raw = tmpfile();
+	fwrite(data, 1, CHAIN_DATA_SIZE, raw);
+	rewind(raw);
+
+	Chain chain = {{&delta, &huff}, {{arg, 0, 0}, {huff_arg, 0, 0}}, 2};
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	(pipelined ? encodeChainPipelined : encodeChain)(&chain, raw, &w);
+	bitstreamFlushWrite(&w);
+
+	// sizing has to agree with the encoder to the byte.
+	rewind(raw);
+	int exact = 0;
+	Count bits = sizeChain(&chain, raw, &exact);
+	sd_assert(exact);
+	sd_assertiq((bits + 31) / 32 * 4, ftell(enc));
+	rewind(enc);
+
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	(pipelined ? decodeChainPipelined : decodeChain)(&chain, &r, sink);
+	sinkClose(sink);
+	sd_assertiq(CHAIN_DATA_SIZE, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(CHAIN_DATA_SIZE);
+	sd_assertiq(CHAIN_DATA_SIZE, fread(back, 1, CHAIN_DATA_SIZE, dec));
+	sd_assert(memcmp(back, data, CHAIN_DATA_SIZE) == 0);
+
+	free(back);
+	free(data);
+	fclose(dec);
+	fclose(enc);
+	fclose(raw);
+	sd_pop();
+}
+
+/* deltas that stay small, zero runs, and a few stretches of noise. */
+static FILE *makeSizeData(void)
+{
+	FILE *file = tmpfile();
+	int32_t v = 0;
+	for (int i = 0; i < CHAIN_DATA_SIZE; ++i) {
+		v += rand() % 5 - 2;
+		int c = i % 4 == 0 ? v : i % 4 == 1 ? v >> 8 : rand() % 3;
+		if (i % KB(16) < KB(2)) c = 0;
+		if (i % KB(50) < 300) c = rand();
+		fputc(c, file);
+	}
+	return file;
+}
+
+/* encodes the input and returns the exact number of bits the chain wrote. */
+static Count encodedBits(Chain const *chain, FILE *in)
+{
+	rewind(in);
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	encodeChain(chain, in, &w);
+	// a stream that ends on a word boundary still gets the empty word of the flush.
+	Count bits = ftell(enc) * 8 + (w.buf_cur > 0 ? w.buf_cur : 32);
+	bitstreamFlushWrite(&w);
+	fclose(enc);
+	return bits;
+}
+
+/* delta on its own used to read the padding as more deltas. */
+static void deltaAlone(char *arg, unsigned char const *data, size_t size)
+{
+	sd_push("delta:%s alone, size = %ld", arg, (long) size);
+	Chain chain = {{&delta}, {{arg, 0, 0}}, 1};
+	FILE *raw = tmpfile();
+	fwrite(data, 1, size, raw);
+	rewind(raw);
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	encodeChain(&chain, raw, &w);
+	bitstreamFlushWrite(&w);
+	rewind(enc);
+
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decodeChain(&chain, &r, sink);
+	sinkClose(sink);
+	sd_assertiq(size, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(size + 1);
+	sd_assertiq(size, fread(back, 1, size, dec));
+	sd_assert(memcmp(back, data, size) == 0);
+
+	free(back);
+	fclose(dec);
+	fclose(enc);
+	fclose(raw);
+	sd_pop();
+}
+
+static void exactSize(char const *name, Chain const *chain, FILE *in)
+{
+	sd_push("%s", name);
+	rewind(in);
+	int exact = 0;
+	Count bits = sizeChain(chain, in, &exact);
+	sd_assert(exact);
+	sd_assertiq(encodedBits(chain, in), bits);
+	sd_pop();
+}
+
+static void sizes(void)
+{
+	sd_push("sizes");
+	FILE *in = makeSizeData();
+	Chain const chains[] = {
+		{{&zle}, {{NULL, 0, 0}}, 1},
+		{{&zle}, {{"16", 0, 0}}, 1},
+		{{&huff}, {{NULL, 0, 0}}, 1},
+		{{&raw}, {{NULL, 0, 0}}, 1},
+		{{&autoAlgorithm}, {{NULL, 0, 0}}, 1},
+		{{&lzw}, {{NULL, 0, 0}}, 1}, // small enough to be run in full
+		{{&delta, &zle}, {{"1", 0, 0}, {NULL, 0, 0}}, 2},
+		// no size function at the end, so these are counted by encoding.
+		{{&rle}, {{NULL, 0, 0}}, 1},
+		{{&dedup}, {{NULL, 0, 0}}, 1},
+		{{&delta}, {{"2", 0, 0}}, 1},
+		{{&huff, &delta}, {{NULL, 0, 0}, {"1", 0, 0}}, 2},
+		{{&delta, &rle}, {{"4:5", 0, 0}, {NULL, 0, 0}}, 2},
+	};
+	char const *names[] = {"zle", "zle:16", "huff", "raw", "auto", "lzw", "delta:1+zle", "rle", "dedup", "delta:2", "huff+delta:1", "delta:4:5+rle"};
+	for (size_t c = 0; c < sizeof(chains) / sizeof(*chains); ++c)
+		exactSize(names[c], &chains[c], in);
+	fclose(in);
+	sd_pop();
+}
+
+/* Inputs too large for LZW to be run in full are estimated from samples,
+ * which for text like this lands within a few percent. */
+static void lzwEstimate(void)
+{
+	sd_push("lzw estimate");
+	static char const *words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "and", "then",
+		"some", "more", "words", "follow", "until", "it", "is", "done", "with", "it"};
+	FILE *in = tmpfile();
+	for (long len = 0; len < MB(6); ) {
+		char const *word = words[rand() % 20];
+		len += fprintf(in, "%s%c", word, rand() % 12 == 0 ? '\n' : ' ');
+	}
+	Chain chain = {{&lzw}, {{NULL, 0, 0}}, 1};
+	rewind(in);
+	int exact = 1;
+	Count estimate = sizeChain(&chain, in, &exact);
+	sd_assert(!exact);
+	Count bits = encodedBits(&chain, in);
+	sd_push("estimate = %ld, encoded = %ld", (long) estimate, (long) bits);
+	sd_assert(estimate > bits - bits / 20 && estimate < bits + bits / 20);
+	sd_pop();
+	fclose(in);
+	sd_pop();
+}
+
+/* Input that can't seek is measured while the first stage reads it, and has
+ * to come out as the same stream a file would. */
+static void unseekable(char const *name, Chain const *chain, size_t size)
+{
+	sd_push("%s from a pipe, size = %ld", name, (long) size);
+	unsigned char *data = malloc(size);
+	for (size_t i = 0; i < size; ++i)
+		data[i] = "aaab\0\0"[rand() % 6];
+	int fds[2];
+	sd_assertiq(0, pipe(fds));
+	sd_assertiq(size, write(fds[1], data, size));
+	close(fds[1]);
+	FILE *in = fdopen(fds[0], "r");
+	FILE *file = tmpfile();
+	fwrite(data, 1, size, file);
+	rewind(file);
+
+	FILE *enc = tmpfile(), *ref = tmpfile();
+	Bitstream w = {enc, 0, 0}, refw = {ref, 0, 0};
+	encodeChain(chain, in, &w);
+	bitstreamFlushWrite(&w);
+	encodeChain(chain, file, &refw);
+	bitstreamFlushWrite(&refw);
+	long const len = ftell(enc);
+	sd_assertiq(ftell(ref), len);
+	rewind(enc);
+	rewind(ref);
+	unsigned char *a = malloc(len + 1), *b = malloc(len + 1);
+	sd_assertiq(len, fread(a, 1, len, enc));
+	sd_assertiq(len, fread(b, 1, len, ref));
+	sd_assert(memcmp(a, b, len) == 0);
+
+	rewind(enc);
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decodeChain(chain, &r, sink);
+	sinkClose(sink);
+	sd_assertiq(size, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(size + 1);
+	sd_assertiq(size, fread(back, 1, size, dec));
+	sd_assert(memcmp(back, data, size) == 0);
+
+	free(back);
+	free(a);
+	free(b);
+	free(data);
+	fclose(dec);
+	fclose(enc);
+	fclose(ref);
+	fclose(file);
+	fclose(in);
+	sd_pop();
+}
+
+void chainTest(void)
+{
+	sd_push("chain");
+	roundtrip("1", NULL, 0);
+	roundtrip("2", NULL, 0);
+	roundtrip("4", NULL, 0);
+	roundtrip("8", NULL, 0);
+	roundtrip("1:3", NULL, 0);
+	roundtrip("4:5", NULL, 0);
+	// the odd data size leaves half a symbol at the end.
+	roundtrip("2", "16", 0);
+	roundtrip("1", "16", 0);
+	roundtrip("2", NULL, 1);
+	roundtrip("4:5", "16", 1);
+	deltaAlone("1", (unsigned char const *) "aaaaaaab", 8);
+	deltaAlone("2", (unsigned char const *) "aaaaaaab", 8);
+	deltaAlone("4:5", (unsigned char const *) "hello, world", 12);
+	deltaAlone("1:3", (unsigned char const *) "abcdefghijk", 11);
+	sizes();
+	lzwEstimate();
+	Chain const single = {{&zle}, {{"16", 0, 0}}, 1};
+	Chain const pair = {{&rle, &zle}, {{NULL, 0, 0}, {NULL, 0, 0}}, 2};
+	Chain const deduped = {{&dedup}, {{NULL, 0, 0}}, 1};
+	Chain const plain = {{&raw}, {{NULL, 0, 0}}, 1};
+	// small enough to fit into the pipe without anyone reading.
+	unseekable("zle:16", &single, KB(40) + 1);
+	unseekable("rle+zle", &pair, KB(40) + 1);
+	unseekable("dedup", &deduped, KB(40) + 1);
+	unseekable("raw", &plain, 0);
+	unseekable("dedup", &deduped, 0);
+	sd_pop();
+}
@@ -0,0 +1,86 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sd_cuts.h"
+
+#include "checksum.h"
+
+static void knownValue(void)
+{
+	sd_push("known value");
+	sd_assertiq(0xE3069283, crc32c(0, "123456789", 9));
+	sd_assertiq(0, crc32c(0, "", 0));
+	sd_assertiq(0xE3069283, crc32cSoftware(0, "123456789", 9));
+	sd_assertiq(0, crc32cSoftware(0, "", 0));
+	sd_pop();
+}
+
+static void piecewise(void)
+{
+	sd_push("piecewise");
+	unsigned char data[1000];
+	for (int i = 0; i < (int) sizeof(data); ++i)
+		data[i] = i * 7 + 3;
+	uint32_t whole = crc32c(0, data + 1, 999);
+	for (int split = 0; split <= 999; split += 37) {
+		sd_push("split = %d", split);
+		sd_assertiq(whole, crc32c(crc32c(0, data + 1, split), data + 1 + split, 999 - split));
+		sd_pop();
+	}
+	sd_pop();
+}
+
+/* the dispatched crc32c may never run the tables on this machine, so check them against it
+ * at every alignment and at lengths around the 8-byte steps. */
+static void softwareMatches(void)
+{
+	sd_push("software matches");
+	unsigned char data[4096 + 16];
+	for (int i = 0; i < (int) sizeof(data); ++i)
+		data[i] = rand();
+	for (int round = 0; round < 500; ++round) {
+		size_t offset = rand() % 16;
+		size_t len = round < 100 ? (size_t) round : (size_t) rand() % 4097;
+		sd_push("offset = %d, length = %d", (int) offset, (int) len);
+		sd_assertiq(crc32c(0, data + offset, len), crc32cSoftware(0, data + offset, len));
+		// either one can pick up where the other left off.
+		size_t split = len / 3;
+		sd_assertiq(crc32c(0, data + offset, len), crc32c(crc32cSoftware(0, data + offset, split), data + offset + split, len - split));
+		sd_pop();
+	}
+	sd_pop();
+}
+
+void checksumTest(void)
+{
+	sd_push("checksum");
+	knownValue();
+	piecewise();
+	softwareMatches();
+	sd_pop();
+}
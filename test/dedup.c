@@ -0,0 +1,213 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+#include "pipeline.h"
+
+extern void encode_dedup(FILE *in, Bitstream *out, Params const *params);
+extern void decode_dedup(Bitstream *in, Sink *out);
+extern void encode_lzw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_lzw(Bitstream *in, Sink *out);
+extern void encode_raw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_raw(Bitstream *in, Sink *out);
+extern void encode_huff(FILE *in, Bitstream *out, Params const *params);
+extern void decode_huff(Bitstream *in, Sink *out);
+
+static Algorithm const dedup = {"dedup", encode_dedup, decode_dedup, ALGORITHM_STREAMS, NULL};
+static Algorithm const lzw = {"lzw", encode_lzw, decode_lzw, ALGORITHM_STREAMS, NULL};
+static Algorithm const huff = {"huff", encode_huff, decode_huff, 0, NULL};
+static Algorithm const rawAlgorithm = {"raw", encode_raw, decode_raw, ALGORITHM_STREAMS, NULL};
+
+#define DEDUP_BLOCK KB(256)
+#define DEDUP_DATA_SIZE (3 * DEDUP_BLOCK + 1234)
+
+/* noise, different noise, the first noise again shifted by a few bytes, and a short tail. */
+static unsigned char *makeData(void)
+{
+	unsigned char *data = malloc(DEDUP_DATA_SIZE);
+	for (int i = 0; i < 2 * DEDUP_BLOCK; ++i)
+		data[i] = rand();
+	memset(data + 2 * DEDUP_BLOCK, 'x', 5);
+	memcpy(data + 2 * DEDUP_BLOCK + 5, data, DEDUP_DATA_SIZE - 2 * DEDUP_BLOCK - 5);
+	return data;
+}
+
+static void roundtrip(int level)
+{
+	sd_push("level %d", level);
+	unsigned char *data = makeData();
+	FILE *raw = tmpfile();
+	fwrite(data, 1, DEDUP_DATA_SIZE, raw);
+	rewind(raw);
+
+	Params params = {NULL, 0, level};
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	encode_dedup(raw, &w, &params);
+	bitstreamFlushWrite(&w);
+	// content-defined cuts resynchronize within a chunk or two of the inserted
+	// bytes, and the chunks are longest at the lowest level.
+	sd_assert(ftell(enc) < 2 * DEDUP_BLOCK + (level == LEVEL_MIN ? DEDUP_BLOCK : DEDUP_BLOCK / 4));
+	rewind(enc);
+
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decode_dedup(&r, sink);
+	sinkClose(sink);
+	sd_assertiq(DEDUP_DATA_SIZE, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(DEDUP_DATA_SIZE);
+	sd_assertiq(DEDUP_DATA_SIZE, fread(back, 1, DEDUP_DATA_SIZE, dec));
+	sd_assert(memcmp(back, data, DEDUP_DATA_SIZE) == 0);
+
+	free(back);
+	free(data);
+	fclose(dec);
+	fclose(enc);
+	fclose(raw);
+	sd_pop();
+}
+
+#define DEDUP_TEXT_SIZE KB(512)
+
+static Count encodedSize(Chain const *chain, FILE *raw)
+{
+	rewind(raw);
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	encodeChain(chain, raw, &w);
+	bitstreamFlushWrite(&w);
+	Count size = ftell(enc);
+	fclose(enc);
+	return size;
+}
+
+/* Without any duplicates, the pre-pass must stay out of the way of the coder behind it. */
+static void passthrough(Algorithm const *coder)
+{
+	sd_push("dedup+%s on unique text", coder->identifier);
+	FILE *raw = tmpfile();
+	for (Count len = 0; len < DEDUP_TEXT_SIZE; ) {
+		char word[16];
+		int n = 2 + rand() % 8;
+		for (int i = 0; i < n; ++i)
+			word[i] = 'a' + rand() % 26;
+		word[n] = rand() % 10 == 0 ? '\n' : ' ';
+		len += fwrite(word, 1, n + 1, raw);
+	}
+
+	Chain alone = {{coder}, {{NULL, 0, 0}}, 1};
+	Chain after = {{&dedup, coder}, {{NULL, 0, 0}, {NULL, 0, 0}}, 2};
+	Count plain = encodedSize(&alone, raw);
+	Count deduped = encodedSize(&after, raw);
+	sd_assert(deduped < plain + plain / 100);
+
+	fclose(raw);
+	sd_pop();
+}
+
+static Count encodeInto(FILE *enc, Chain const *chain, FILE *raw, int pipelined)
+{
+	rewind(raw);
+	Bitstream w = {enc, 0, 0};
+	(pipelined ? encodeChainPipelined : encodeChain)(chain, raw, &w);
+	bitstreamFlushWrite(&w);
+	return ftell(enc);
+}
+
+/* literals end anywhere, yet whatever copies the last stage by the word must get all of it. */
+static void last(int extra)
+{
+	sd_push("raw+dedup, pipelined, %d more bytes", extra);
+	// raw reorders the bytes within each word, so the repeat has to start on one.
+	size_t total = 2 * DEDUP_BLOCK + extra;
+	unsigned char *data = malloc(total);
+	for (size_t i = 0; i < total; ++i)
+		data[i] = i < DEDUP_BLOCK || i >= 2 * DEDUP_BLOCK ? rand() : data[i - DEDUP_BLOCK];
+	FILE *raw = tmpfile();
+	fwrite(data, 1, total, raw);
+
+	Chain chain = {{&rawAlgorithm, &dedup}, {{NULL, 0, 0}, {NULL, 0, 0}}, 2};
+	FILE *seq = tmpfile(), *enc = tmpfile();
+	Count size = encodeInto(seq, &chain, raw, 0);
+	sd_assertiq(size, encodeInto(enc, &chain, raw, 1));
+	rewind(raw);
+	int exact = 0;
+	Count bits = sizeChain(&chain, raw, &exact);
+	sd_assert(exact);
+	sd_assertiq(size, (bits + 31) / 32 * 4);
+	rewind(seq);
+	rewind(enc);
+	char *a = malloc(size), *b = malloc(size);
+	sd_assertiq(size, fread(a, 1, size, seq));
+	sd_assertiq(size, fread(b, 1, size, enc));
+	sd_assert(memcmp(a, b, size) == 0);
+	free(a);
+	free(b);
+	rewind(enc);
+
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decodeChainPipelined(&chain, &r, sink);
+	sinkClose(sink);
+	sd_assertiq(total, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(total);
+	sd_assertiq(total, fread(back, 1, total, dec));
+	sd_assert(memcmp(back, data, total) == 0);
+
+	free(back);
+	free(data);
+	fclose(dec);
+	fclose(enc);
+	fclose(seq);
+	fclose(raw);
+	sd_pop();
+}
+
+void dedupTest(void)
+{
+	sd_push("dedup");
+	roundtrip(LEVEL_MIN);
+	roundtrip(LEVEL_DEFAULT);
+	roundtrip(LEVEL_MAX);
+	passthrough(&lzw);
+	passthrough(&huff);
+	for (int extra = 0; extra < 4; ++extra)
+		last(extra);
+	sd_pop();
+}
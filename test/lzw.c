@@ -0,0 +1,102 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+
+extern void encode_lzw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_lzw(Bitstream *in, Sink *out);
+
+static Algorithm const lzw = {"lzw", encode_lzw, decode_lzw, ALGORITHM_STREAMS, NULL};
+
+#define LZW_DATA_SIZE KB(192)
+
+/* text-like, then noise, then text again, so a full dictionary stops paying off halfway. */
+static unsigned char *makeData(void)
+{
+	unsigned char *data = malloc(LZW_DATA_SIZE);
+	for (int i = 0; i < LZW_DATA_SIZE; ++i) {
+		if (i >= KB(64) && i < KB(128)) {
+			data[i] = rand();
+		} else {
+			data[i] = "the quick brown fox "[rand() % 20];
+		}
+	}
+	return data;
+}
+
+static void roundtrip(int level, Count mem_budget)
+{
+	sd_push("level %d, budget %ld", level, (long) mem_budget);
+	unsigned char *data = makeData();
+	FILE *raw = tmpfile();
+	fwrite(data, 1, LZW_DATA_SIZE, raw);
+	rewind(raw);
+
+	Chain chain = {{&lzw}, {{NULL, mem_budget, level}}, 1};
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	encodeChain(&chain, raw, &w);
+	bitstreamFlushWrite(&w);
+	rewind(enc);
+
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decodeChain(&chain, &r, sink);
+	sinkClose(sink);
+	sd_assertiq(LZW_DATA_SIZE, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(LZW_DATA_SIZE);
+	sd_assertiq(LZW_DATA_SIZE, fread(back, 1, LZW_DATA_SIZE, dec));
+	sd_assert(memcmp(back, data, LZW_DATA_SIZE) == 0);
+
+	free(back);
+	free(data);
+	fclose(dec);
+	fclose(enc);
+	fclose(raw);
+	sd_pop();
+}
+
+void lzwTest(void)
+{
+	sd_push("lzw");
+	roundtrip(LEVEL_MIN, 0);
+	roundtrip(LEVEL_DEFAULT, 0);
+	roundtrip(LEVEL_MAX, 0);
+	// small dictionaries fill up and start over several times.
+	roundtrip(LEVEL_DEFAULT, KB(16));
+	roundtrip(LEVEL_MAX, KB(16));
+	sd_pop();
+}
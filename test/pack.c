@@ -0,0 +1,205 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+#include "pack.h"
+
+extern void encode_lzw(FILE *in, Bitstream *out, Params const *params);
+extern void decode_lzw(Bitstream *in, Sink *out);
+
+static Algorithm const lzwAlgorithm = {"lzw", encode_lzw, decode_lzw, ALGORITHM_STREAMS, NULL};
+static Chain const lzw = {{&lzwAlgorithm}, {{NULL, 0, 0}}, 1};
+
+#define PACK_DATA_SIZE (PACK_BLOCK_SIZE * 3 + 1234)
+
+static unsigned char *makeData(void)
+{
+	unsigned char *data = malloc(PACK_DATA_SIZE);
+	for (int i = 0; i < PACK_DATA_SIZE; ++i)
+		data[i] = "abcabdabe"[rand() % 9];
+	return data;
+}
+
+static FILE *packWith(Chain const *chain, uint32_t block_size, unsigned char *data, unsigned flags)
+{
+	FILE *raw = tmpfile();
+	fwrite(data, 1, PACK_DATA_SIZE, raw);
+	rewind(raw);
+	FILE *packed = tmpfile();
+	sd_assertiq(0, packStream(chain, raw, packed, block_size, flags));
+	fclose(raw);
+	return packed;
+}
+
+static FILE *packData(unsigned char *data, unsigned flags)
+{
+	return packWith(&lzw, PACK_BLOCK_SIZE, data, flags);
+}
+
+static void checkRange(FILE *packed, unsigned char *data, Count offset, Count length)
+{
+	sd_push("offset = %ld, length = %ld", (long) offset, (long) length);
+	FILE *out = tmpfile();
+	Sink *sink = sinkOpenFile(out);
+	sd_assertiq(0, extractRange(&lzw, packed, sink, offset, length));
+	sd_assertiq(0, sinkClose(sink));
+	sd_assertiq(length, ftell(out));
+	rewind(out);
+	unsigned char *back = malloc(length + 1);
+	sd_assertiq(length, fread(back, 1, length, out));
+	sd_assert(memcmp(back, data + offset, length) == 0);
+	free(back);
+	fclose(out);
+	sd_pop();
+}
+
+static void roundtrip(void)
+{
+	sd_push("roundtrip");
+	unsigned char *data = makeData();
+	FILE *packed = packData(data, 0);
+	checkRange(packed, data, 0, PACK_DATA_SIZE);
+	fclose(packed);
+	packed = packData(data, PACK_CHECKSUM);
+	checkRange(packed, data, 0, PACK_DATA_SIZE);
+	fclose(packed);
+	free(data);
+	sd_pop();
+}
+
+static void extract(void)
+{
+	sd_push("extract");
+	unsigned char *data = makeData();
+	FILE *packed = packData(data, PACK_CHECKSUM);
+	checkRange(packed, data, 0, 1);
+	checkRange(packed, data, PACK_BLOCK_SIZE - 100, 200);
+	checkRange(packed, data, PACK_BLOCK_SIZE * 2, PACK_BLOCK_SIZE);
+	checkRange(packed, data, PACK_DATA_SIZE - 10, 10);
+	fclose(packed);
+	free(data);
+	sd_pop();
+}
+
+static void budget(void)
+{
+	sd_push("budget");
+	// small enough for the dictionary to fill up and start over a few times per block.
+	Chain const small = {{&lzwAlgorithm}, {{NULL, KB(16), 0}}, 1};
+	uint32_t block_size = packBlockSize(0, KB(64));
+	sd_assertiq(KB(8), block_size);
+	unsigned char *data = makeData();
+	FILE *packed = packWith(&small, block_size, data, PACK_CHECKSUM);
+	checkRange(packed, data, 0, PACK_DATA_SIZE);
+	checkRange(packed, data, block_size * 5 - 7, block_size + 14);
+	fclose(packed);
+	free(data);
+	sd_pop();
+}
+
+static void notPacked(void)
+{
+	sd_push("not packed");
+	FILE *file = tmpfile();
+	fwrite("definitely not a pack stream", 1, 28, file);
+	rewind(file);
+	FILE *out = tmpfile();
+	Sink *sink = sinkOpenFile(out);
+	sd_assert(extractRange(&lzw, file, sink, 0, 10) != 0);
+	sinkClose(sink);
+	fclose(out);
+	fclose(file);
+	sd_pop();
+}
+
+static void corrupted(void)
+{
+	sd_push("corrupted");
+	unsigned char *data = makeData();
+	FILE *packed = packData(data, PACK_CHECKSUM);
+	fseek(packed, 100, SEEK_SET);
+	int c = fgetc(packed);
+	fseek(packed, 100, SEEK_SET);
+	fputc(c ^ 0x10, packed);
+	FILE *out = tmpfile();
+	Sink *sink = sinkOpenFile(out);
+	sd_assert(extractRange(&lzw, packed, sink, 0, 10) != 0);
+	sd_assertiq(0, extractRange(&lzw, packed, sink, PACK_BLOCK_SIZE, 10));
+	sinkClose(sink);
+	fclose(out);
+	fclose(packed);
+	free(data);
+	sd_pop();
+}
+
+/* overwrites the raw size, the first field of the trailer at the very end. */
+static void tamperRawSize(FILE *packed, uint64_t raw_size)
+{
+	fseek(packed, -24, SEEK_END);
+	for (int shift = 56; shift >= 0; shift -= 8)
+		fputc(raw_size >> shift & 0xFF, packed);
+	fflush(packed);
+}
+
+static void badTrailer(void)
+{
+	sd_push("bad trailer");
+	unsigned char *data = makeData();
+	uint64_t const sizes[] = {PACK_DATA_SIZE + PACK_BLOCK_SIZE, UINT64_MAX, UINT64_C(1) << 63};
+	for (size_t i = 0; i < STATIC_LENGTH(sizes); ++i) {
+		sd_push("raw size %llu", (unsigned long long) sizes[i]);
+		FILE *packed = packData(data, 0);
+		tamperRawSize(packed, sizes[i]);
+		FILE *out = tmpfile();
+		Sink *sink = sinkOpenFile(out);
+		sd_assert(unpackStream(&lzw, packed, sink) != 0);
+		sinkClose(sink);
+		fclose(out);
+		fclose(packed);
+		sd_pop();
+	}
+	free(data);
+	sd_pop();
+}
+
+void packTest(void)
+{
+	sd_push("pack");
+	roundtrip();
+	extract();
+	budget();
+	notPacked();
+	corrupted();
+	badTrailer();
+	sd_pop();
+}
@@ -0,0 +1,110 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+
+extern void encode_rle(FILE *in, Bitstream *out, Params const *params);
+extern void decode_rle(Bitstream *in, Sink *out);
+
+#define RLE_DATA_SIZE KB(512)
+
+/* literals and runs of every length up to a few, a run much longer than the
+ * encoder's buffer, and one that straddles a buffer boundary. The data ends
+ * in a run when tail_run is set. */
+static unsigned char *makeData(size_t size, int tail_run)
+{
+	unsigned char *data = malloc(size);
+	size_t i = 0;
+	while (i < size) {
+		size_t len = 1 + rand() % 5;
+		if (i > KB(100) && i < KB(110)) len = KB(200);
+		if (i > KB(380) && i < KB(384)) len = KB(64) + 5;
+		unsigned char sym = rand() % 4 == 0 ? 0 : rand();
+		for (size_t j = 0; j < len && i < size; ++j)
+			data[i++] = sym;
+	}
+	if (tail_run) {
+		memset(data + size - 1000, 'x', 1000);
+	} else {
+		data[size - 2] = 'a';
+		data[size - 1] = 'b';
+	}
+	return data;
+}
+
+static void roundtrip(size_t size, int tail_run)
+{
+	sd_push("size = %ld, tail run = %d", (long) size, tail_run);
+	unsigned char *data = makeData(size, tail_run);
+	FILE *raw = tmpfile();
+	fwrite(data, 1, size, raw);
+	rewind(raw);
+
+	Params params = {NULL, 0, LEVEL_DEFAULT};
+	FILE *enc = tmpfile();
+	Bitstream w = {enc, 0, 0};
+	encode_rle(raw, &w, &params);
+	bitstreamFlushWrite(&w);
+	rewind(enc);
+
+	// the stream has an end code, so what comes back is exactly the input.
+	FILE *dec = tmpfile();
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decode_rle(&r, sink);
+	sinkClose(sink);
+	sd_assertiq(size, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(size + 1);
+	sd_assertiq(size, fread(back, 1, size, dec));
+	sd_assert(memcmp(back, data, size) == 0);
+
+	free(back);
+	free(data);
+	fclose(dec);
+	fclose(enc);
+	fclose(raw);
+	sd_pop();
+}
+
+void rleTest(void)
+{
+	sd_push("rle");
+	roundtrip(RLE_DATA_SIZE, 0);
+	roundtrip(RLE_DATA_SIZE, 1);
+	roundtrip(RLE_DATA_SIZE + 1, 0);
+	// a run that reaches exactly to the end of the encoder's buffer.
+	roundtrip(KB(64), 1);
+	roundtrip(KB(128) + 3, 1);
+	sd_pop();
+}
@@ -0,0 +1,216 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#define _GNU_SOURCE // for splice
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sd_cuts.h"
+
+#include "sink.h"
+
+#define SINK_DATA_SIZE (SINK_FILE_BUFFER_SIZE * 3 + 17)
+
+/* some bytes, a run that crosses a buffer boundary, and more bytes. */
+static void fill(Sink *sink, unsigned char *expect)
+{
+	for (int i = 0; i < 1000; ++i) {
+		expect[i] = i * 7;
+		sinkPutc(sink, expect[i]);
+	}
+	memset(expect + 1000, 0xAB, SINK_FILE_BUFFER_SIZE);
+	sinkFill(sink, 0xAB, SINK_FILE_BUFFER_SIZE);
+	for (int i = 1000 + SINK_FILE_BUFFER_SIZE; i < SINK_DATA_SIZE; ++i)
+		expect[i] = i % 251;
+	sinkWrite(sink, expect + 1000 + SINK_FILE_BUFFER_SIZE, SINK_DATA_SIZE - 1000 - SINK_FILE_BUFFER_SIZE);
+}
+
+static void check(FILE *file, unsigned char const *expect)
+{
+	unsigned char *back = malloc(SINK_DATA_SIZE + 1);
+	rewind(file);
+	sd_assertiq(SINK_DATA_SIZE, fread(back, 1, SINK_DATA_SIZE + 1, file));
+	sd_assert(memcmp(back, expect, SINK_DATA_SIZE) == 0);
+	free(back);
+}
+
+static void toFile(void)
+{
+	sd_push("file");
+	unsigned char *expect = malloc(SINK_DATA_SIZE);
+	FILE *file = tmpfile();
+	Sink *sink = sinkOpenFile(file);
+	fill(sink, expect);
+	sd_assertiq(0, sinkClose(sink));
+	check(file, expect);
+	fclose(file);
+	free(expect);
+	sd_pop();
+}
+
+static void toFd(void)
+{
+	sd_push("fd");
+	unsigned char *expect = malloc(SINK_DATA_SIZE);
+	FILE *file = tmpfile();
+	Sink *sink = sinkOpenFd(fileno(file));
+	fill(sink, expect);
+	sd_assertiq(0, sinkClose(sink));
+	check(file, expect);
+	fclose(file);
+	free(expect);
+	sd_pop();
+}
+
+/* zero runs over old contents and past the end, skipped rather than written. */
+static void toSparseFd(void)
+{
+	sd_push("sparse fd");
+	size_t const size = 4 * SINK_HOLE_MIN + 2;
+	unsigned char *expect = calloc(size, 1);
+	expect[0] = 'a';
+	expect[2 * SINK_HOLE_MIN + 1] = 'b';
+	FILE *file = tmpfile();
+	unsigned char *old = malloc(3 * SINK_HOLE_MIN);
+	memset(old, 'z', 3 * SINK_HOLE_MIN);
+	fwrite(old, 1, 3 * SINK_HOLE_MIN, file);
+	fflush(file);
+	lseek(fileno(file), 0, SEEK_SET);
+
+	Sink *sink = sinkOpenFd(fileno(file));
+	sinkPutc(sink, 'a');
+	sinkFill(sink, 0, 2 * SINK_HOLE_MIN);
+	sinkPutc(sink, 'b');
+	sinkFill(sink, 0, 2 * SINK_HOLE_MIN);
+	sd_assertiq(0, sinkClose(sink));
+
+	unsigned char *back = malloc(size + 1);
+	rewind(file);
+	sd_assertiq(size, fread(back, 1, size + 1, file));
+	sd_assert(memcmp(back, expect, size) == 0);
+	free(back);
+	free(old);
+	fclose(file);
+	free(expect);
+	sd_pop();
+}
+
+static void toPipe(void)
+{
+	sd_push("pipe");
+	int fds[2];
+	sd_assertiq(0, pipe(fds));
+	Sink *sink = sinkOpenFd(fds[1]);
+	// small enough to fit into the pipe without anybody reading.
+	unsigned char data[300];
+	for (int i = 0; i < 300; ++i)
+		data[i] = i;
+	sinkWrite(sink, data, 200);
+	sinkFlush(sink);
+	sinkWrite(sink, data + 200, 100);
+	sd_assertiq(0, sinkClose(sink));
+	close(fds[1]);
+	unsigned char back[301];
+	size_t len = 0;
+	ssize_t n;
+	while ((n = read(fds[0], back + len, sizeof(back) - len)) > 0)
+		len += n;
+	close(fds[0]);
+	sd_assertiq(300, len);
+	sd_assert(memcmp(back, data, 300) == 0);
+	sd_pop();
+}
+
+/* everything past the limit is dropped, holes included, and lifting it lets bytes through again. */
+static void limited(void)
+{
+	sd_push("limit");
+	FILE *file = tmpfile();
+	Sink *sink = sinkOpenFd(fileno(file));
+	sinkLimit(sink, 2 * SINK_HOLE_MIN + 3);
+	sinkWrite(sink, "abc", 3);
+	sinkFill(sink, 0, 2 * SINK_HOLE_MIN);
+	sinkWrite(sink, "def", 3);
+	sinkFill(sink, 0, 5 * SINK_HOLE_MIN);
+	sinkLimit(sink, SINK_UNLIMITED);
+	sinkPutc(sink, 'g');
+	sd_assertiq(0, sinkClose(sink));
+	sd_assertiq(2 * SINK_HOLE_MIN + 4, lseek(fileno(file), 0, SEEK_END));
+	unsigned char back[8];
+	rewind(file);
+	sd_assertiq(3, fread(back, 1, 3, file));
+	sd_assert(memcmp(back, "abc", 3) == 0);
+	fseek(file, 2 * SINK_HOLE_MIN, SEEK_SET);
+	sd_assertiq(4, fread(back, 1, sizeof(back), file));
+	sd_assert(memcmp(back, "\0\0\0g", 4) == 0);
+	fclose(file);
+	sd_pop();
+}
+
+/* A reader that splices the pipe on holds on to the sink's pages long after
+ * they have left the pipe, so the sink must not write to them again. */
+static void toPipeSplicedOn(void)
+{
+	sd_push("pipe, spliced on");
+	int fds[2], onward[2];
+	sd_assertiq(0, pipe(fds));
+	sd_assertiq(0, pipe(onward));
+	Sink *sink = sinkOpenFd(fds[1]);
+	unsigned char data[4000];
+	for (int i = 0; i < 4000; ++i)
+		data[i] = i * 13 + i / 256;
+	for (int c = 0; c < 4; ++c) {
+		sinkWrite(sink, data + c * 1000, 1000);
+		sinkFlush(sink);
+		sd_assertiq(1000, splice(fds[0], NULL, onward[1], NULL, 1000, 0));
+	}
+	sd_assertiq(0, sinkClose(sink));
+	close(fds[1]);
+	close(fds[0]);
+	close(onward[1]);
+	unsigned char back[4001];
+	size_t len = 0;
+	ssize_t n;
+	while ((n = read(onward[0], back + len, sizeof(back) - len)) > 0)
+		len += n;
+	close(onward[0]);
+	sd_assertiq(4000, len);
+	sd_assert(memcmp(back, data, 4000) == 0);
+	sd_pop();
+}
+
+void sinkTest(void)
+{
+	sd_push("sink");
+	toFile();
+	toFd();
+	toSparseFd();
+	limited();
+	toPipe();
+	toPipeSplicedOn();
+	sd_pop();
+}
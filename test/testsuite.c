@@ -25,12 +25,36 @@
 #include "sd_cuts.h"
 
 extern void bitstreamTest(void);
+extern void packTest(void);
+extern void checksumTest(void);
+extern void chainTest(void);
+extern void lzwTest(void);
+extern void sinkTest(void);
+extern void dedupTest(void);
+extern void batchTest(void);
+extern void asyncioTest(void);
+extern void zleTest(void);
+extern void rleTest(void);
+extern void autoTest(void);
+extern void huffTest(void);
 
 int main()
 {
 	sd_execmodel = sd_resilient;
 	sd_init();
 	sd_branch( bitstreamTest(); );
+	sd_branch( packTest(); );
+	sd_branch( checksumTest(); );
+	sd_branch( chainTest(); );
+	sd_branch( lzwTest(); );
+	sd_branch( sinkTest(); );
+	sd_branch( dedupTest(); );
+	sd_branch( batchTest(); );
+	sd_branch( asyncioTest(); );
+	sd_branch( zleTest(); );
+	sd_branch( rleTest(); );
+	sd_branch( autoTest(); );
+	sd_branch( huffTest(); );
 	sd_summarize();
 	return 0;
 }
@@ -0,0 +1,214 @@
+/****
+ * This file is part of cmplab, the rapid compression experimentation project.
+ * Copyright (c) 2018 Thomas Oltmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ****/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sd_cuts.h"
+
+#include "bitstream.h"
+#include "sink.h"
+#include "base.h"
+#include "chain.h"
+
+extern void encode_zle(FILE *in, Bitstream *out, Params const *params);
+extern void decode_zle(Bitstream *in, Sink *out);
+extern Count size_zle(FILE *in, Params const *params, int *exact);
+
+static Algorithm const zle = {"zle", encode_zle, decode_zle, ALGORITHM_STREAMS | ALGORITHM_SPARSE, size_zle};
+
+// the length of the input a chain puts in front of the stream.
+#define CHAIN_HEADER_BITS 64
+
+#define ZLE_DATA_SIZE KB(512)
+
+/* zero runs of every length up to a few (so 16-bit zeros fall on both
+ * byte offsets), one much longer than the encoder's buffer, and one that
+ * straddles a buffer boundary; ending in zeros when tail_run is set. */
+static unsigned char *makeData(size_t size, int tail_run)
+{
+	unsigned char *data = malloc(size);
+	size_t i = 0;
+	while (i < size) {
+		size_t len = 1 + rand() % 5;
+		if (i > KB(100) && i < KB(110)) len = KB(200) + 1;
+		if (i > KB(380) && i < KB(384)) len = KB(64) + 5;
+		unsigned char sym = rand() % 2 == 0 ? 0 : rand();
+		for (size_t j = 0; j < len && i < size; ++j)
+			data[i++] = sym;
+	}
+	if (tail_run) {
+		memset(data + size - 1001, 0, 1001);
+	} else {
+		data[size - 1] = 'z';
+	}
+	return data;
+}
+
+/* data at an odd offset, a stretch longer than the encoder's buffer, and a
+ * hole at the end whose length is odd. */
+#define SPARSE_SIZE (MB(3) + 1)
+#define SPARSE_DATA1 (MB(1) + 1)
+#define SPARSE_DATA2 (MB(2) + 3)
+
+static unsigned char *makeSparseData(void)
+{
+	unsigned char *data = calloc(SPARSE_SIZE, 1);
+	for (int i = 0; i < 1001; ++i)
+		data[SPARSE_DATA1 + i] = rand() % 4; // with zeros of its own
+	for (int i = 0; i < KB(70); ++i)
+		data[SPARSE_DATA2 + i] = rand();
+	return data;
+}
+
+/* the same contents either with real holes or with every zero written out. */
+static FILE *makeSparseFile(unsigned char const *data, int holes)
+{
+	FILE *file = tmpfile();
+	if (holes) {
+		sd_assertiq(0, ftruncate(fileno(file), SPARSE_SIZE));
+		fseek(file, SPARSE_DATA1, SEEK_SET);
+		fwrite(data + SPARSE_DATA1, 1, 1001, file);
+		fseek(file, SPARSE_DATA2, SEEK_SET);
+		fwrite(data + SPARSE_DATA2, 1, KB(70), file);
+	} else {
+		fwrite(data, 1, SPARSE_SIZE, file);
+	}
+	fflush(file);
+	return file;
+}
+
+/* encodes from start on and returns the number of bits written, leaving enc flushed. */
+static Count encode(FILE *raw, long start, FILE *enc, Params const *params)
+{
+	fseek(raw, start, SEEK_SET);
+	Chain chain = {{&zle}, {*params}, 1};
+	Bitstream w = {enc, 0, 0};
+	encodeChain(&chain, raw, &w);
+	Count bits = ftell(enc) * 8 + w.buf_cur;
+	bitstreamFlushWrite(&w);
+	return bits;
+}
+
+static void checkSame(FILE *a, FILE *b)
+{
+	long const len = ftell(a);
+	sd_assertiq(len, ftell(b));
+	unsigned char *abuf = malloc(len + 1), *bbuf = malloc(len + 1);
+	rewind(a);
+	rewind(b);
+	sd_assertiq(len, fread(abuf, 1, len, a));
+	sd_assertiq(len, fread(bbuf, 1, len, b));
+	sd_assert(memcmp(abuf, bbuf, len) == 0);
+	free(abuf);
+	free(bbuf);
+}
+
+static void checkDecode(FILE *enc, unsigned char const *data, Count len)
+{
+	rewind(enc);
+	FILE *dec = tmpfile();
+	Chain chain = {{&zle}, {{NULL, 0, 0}}, 1};
+	Bitstream r = {enc, 0, 0};
+	bitstreamFlushRead(&r);
+	Sink *sink = sinkOpenFile(dec);
+	decodeChain(&chain, &r, sink);
+	sinkClose(sink);
+	sd_assertiq(len, ftell(dec));
+	rewind(dec);
+	unsigned char *back = malloc(len + 1);
+	sd_assertiq(len, fread(back, 1, len, dec));
+	sd_assert(memcmp(back, data, len) == 0);
+	free(back);
+	fclose(dec);
+}
+
+/* through a memory stream, so that the encoder reads it like a pipe. */
+static void roundtrip(char *arg, size_t size, int tail_run)
+{
+	sd_push("zle:%s, size = %ld, tail run = %d", arg ? arg : "8", (long) size, tail_run);
+	unsigned char *data = makeData(size, tail_run);
+	FILE *raw = fmemopen(data, size, "rb");
+	Params params = {arg, 0, LEVEL_DEFAULT};
+	FILE *enc = tmpfile();
+	Count const bits = encode(raw, 0, enc, &params);
+	checkDecode(enc, data, size);
+
+	int exact = 0;
+	rewind(raw);
+	sd_assertiq(bits, CHAIN_HEADER_BITS + size_zle(raw, &params, &exact));
+	sd_assert(exact);
+
+	fclose(enc);
+	fclose(raw);
+	free(data);
+	sd_pop();
+}
+
+static void sparse(char *arg, long start)
+{
+	sd_push("zle:%s from %ld", arg ? arg : "8", start);
+	unsigned char *data = makeSparseData();
+	FILE *holey = makeSparseFile(data, 1);
+	FILE *dense = makeSparseFile(data, 0);
+	Params params = {arg, 0, LEVEL_DEFAULT};
+
+	// skipping the holes has to give the very same stream as reading the zeros.
+	FILE *enc = tmpfile(), *ref = tmpfile();
+	Count const bits = encode(holey, start, enc, &params);
+	sd_assertiq(bits, encode(dense, start, ref, &params));
+	sd_assertiq(SPARSE_SIZE, ftell(holey));
+	checkSame(enc, ref);
+	checkDecode(enc, data + start, SPARSE_SIZE - start);
+
+	int exact = 0;
+	fseek(holey, start, SEEK_SET);
+	sd_assertiq(bits, CHAIN_HEADER_BITS + size_zle(holey, &params, &exact));
+	sd_assert(exact);
+
+	fclose(ref);
+	fclose(enc);
+	fclose(dense);
+	fclose(holey);
+	free(data);
+	sd_pop();
+}
+
+void zleTest(void)
+{
+	sd_push("zle");
+	roundtrip(NULL, ZLE_DATA_SIZE, 0);
+	roundtrip(NULL, ZLE_DATA_SIZE + 1, 1);
+	roundtrip("16", ZLE_DATA_SIZE, 1);
+	// an odd trailing byte, zero or not.
+	roundtrip("16", ZLE_DATA_SIZE + 1, 0);
+	roundtrip("16", ZLE_DATA_SIZE + 1, 1);
+	sparse(NULL, 0);
+	sparse("16", 0);
+	// every hole starts half a symbol in.
+	sparse("16", 1);
+	sd_pop();
+}